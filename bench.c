@@ -0,0 +1,293 @@
+/*
+ * Throughput of the rawview hot paths on synthetic data: the input engine,
+ * graph_desc::analyze and the rendering into the framebuffer, per corpus
+ * and per graph.
+ */
+#include <stdarg.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include "utils.h"
+#include "rawview.h"
+#include "input.h"
+#include "hist.h"
+#include "classify.h"
+#include "pool.h"
+
+char RAWVIEW[] = "rawview-bench";
+
+int trace_if(int level, const char *fmt, ...)
+{
+	return 0;
+}
+
+int printf_error(const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	int ret = vfprintf(stderr, fmt, args);
+	va_end(args);
+	return ret;
+}
+
+static uint64_t xorshift(uint64_t *s)
+{
+	*s ^= *s << 13;
+	*s ^= *s >> 7;
+	*s ^= *s << 17;
+	return *s;
+}
+
+static void gen_zeros(uint8_t *buf, size_t size)
+{
+	memset(buf, 0, size);
+}
+
+static void gen_random(uint8_t *buf, size_t size)
+{
+	uint64_t s = 0x9e3779b97f4a7c15ull;
+	size_t i;
+
+	for (i = 0; i < size; ++i)
+		buf[i] = xorshift(&s) >> 32;
+}
+
+static void gen_text(uint8_t *buf, size_t size)
+{
+	static const char *const words[] = {
+		"the", "of", "block", "offset", "rawview", "input", "graph",
+		"and", "a", "to", "in", "is", "data", "for", "0x1000", "size",
+	};
+	uint64_t s = 1;
+	size_t i = 0;
+
+	while (i < size) {
+		const char *w = words[xorshift(&s) % countof(words)];
+
+		while (*w && i < size)
+			buf[i++] = *w++;
+		if (i < size)
+			buf[i++] = xorshift(&s) % 12 ? ' ' : '\n';
+	}
+}
+
+/* prefixes, REX, opcodes, modrm and small immediates in x86-64 proportions */
+static void gen_code(uint8_t *buf, size_t size)
+{
+	static const uint8_t ops[] = {
+		0x89, 0x8b, 0x83, 0x85, 0x8d, 0x74, 0x75, 0xe8, 0xc3, 0x31, 0x39, 0x0f,
+	};
+	uint64_t s = 7;
+	size_t i = 0;
+
+	while (i < size) {
+		uint64_t r = xorshift(&s);
+
+		if (r % 3 == 0)
+			buf[i++] = 0x48 | (r >> 8 & 5);
+		if (i < size)
+			buf[i++] = ops[(r >> 16) % countof(ops)];
+		if (i < size)
+			buf[i++] = 0xc0 | (r >> 24 & 0x3f);
+		if (i < size && r >> 32 & 1)
+			buf[i++] = r >> 40 & 0x1f;
+		if (i < size && !(r >> 48 & 0xf))
+			buf[i++] = 0;
+	}
+}
+
+/* near random with a skewed byte distribution, like entropy coded data */
+static void gen_compressed(uint8_t *buf, size_t size)
+{
+	uint64_t s = 11;
+	size_t i;
+
+	for (i = 0; i < size; ++i) {
+		uint64_t r = xorshift(&s);
+
+		buf[i] = r & 0x700 ? r >> 32 : (r >> 32) & 0x3f;
+	}
+}
+
+static const struct corpus
+{
+	const char *name;
+	void (*gen)(uint8_t *, size_t);
+} corpora[] = {
+	{ "zeros", gen_zeros },
+	{ "random", gen_random },
+	{ "text", gen_text },
+	{ "code", gen_code },
+	{ "compressed", gen_compressed },
+};
+
+static struct graph_desc *const graphs[] = {
+	&conti_graph,
+	&bytes_graph,
+	&entropy_graph,
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *what, const char *corpus, size_t bytes, double secs,
+		   long frames, unsigned long requests)
+{
+	printf("%-12s %-10s %10.1f MB/s %8.3f ns/byte", what, corpus,
+	       bytes / secs / 1e6, secs * 1e9 / bytes);
+	if (frames)
+		printf(" %6.1f req/frame", (double)requests / frames);
+	putchar('\n');
+}
+
+/* one full frame per block: start_block, analyze, render and flush */
+static void bench_graph(struct graph_desc *graph, struct window *view,
+			struct input *in, const char *engine, const char *corpus,
+			size_t size, size_t blk)
+{
+	char what[32];
+	unsigned long requests = view->fb.requests;
+	long frames = 0;
+	double t0;
+
+	if (graph->setup)
+		graph->setup(view, blk);
+	t0 = now();
+	for (in->input_offset = 0; in->input_offset + blk <= size; in->input_offset += blk) {
+		const uint8_t *data;
+		ssize_t rd;
+
+		if (!in->map)
+			lseek(in->pfd.fd, in->input_offset, SEEK_SET);
+		input_start_block(in);
+		graph->start_block(view, in->input_offset);
+		while (in->amount < blk &&
+		       (rd = input_next(in, &data, blk - in->amount)) > 0)
+			graph->analyze(view, data, rd);
+		if (graph->render)
+			graph->render(view);
+		fb_flush(view);
+		++frames;
+	}
+	snprintf(what, sizeof(what), "%s/%s", graph->name, engine);
+	report(what, corpus, frames * blk, now() - t0, frames, view->fb.requests - requests);
+	/* the next graph sets the view up for itself */
+	if (graph->destroy)
+		graph->destroy(view);
+}
+
+static uint32_t bigrams[BIGRAMS];
+static struct pool *pool;
+
+static void bench_kernels(const uint8_t *buf, size_t size, const char *corpus)
+{
+	uint8_t cls[4096];
+	size_t i;
+	double t0;
+
+	t0 = now();
+	bigram_count(bigrams, buf, size);
+	report("bigram", corpus, size, now() - t0, 0, 0);
+
+	t0 = now();
+	bigram_count_pool(pool, bigrams, buf, size);
+	report("bigram/pool", corpus, size, now() - t0, 0, 0);
+
+	t0 = now();
+	for (i = 0; i + sizeof(cls) <= size; i += sizeof(cls))
+		classify_bytes(&ascii_classes, cls, buf + i, sizeof(cls));
+	report("classify", corpus, i, now() - t0, 0, 0);
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: %s [-s corpus size] [-B block size] [-g WxH]\n", RAWVIEW);
+	exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+	size_t size = 64 << 20, blk = 1 << 20;
+	unsigned width = 512, height = 512, i, g;
+	char tmpl[] = "/tmp/rawview-bench.XXXXXX";
+	struct window view = { 0 };
+	uint8_t *buf;
+	int opt, fd;
+
+	while ((opt = getopt(argc, argv, "s:B:g:h")) != -1)
+		switch (opt) {
+		case 's':
+			size = strtoull(optarg, NULL, 0);
+			break;
+		case 'B':
+			blk = strtoull(optarg, NULL, 0);
+			break;
+		case 'g':
+			if (sscanf(optarg, "%ux%u", &width, &height) != 2)
+				usage();
+			break;
+		default:
+			usage();
+		}
+	if (!size || !blk || blk > size || !width || !height ||
+	    width > UINT16_MAX || height > UINT16_MAX)
+		usage();
+
+	view.graph_area.width = width;
+	view.graph_area.height = height;
+	buf = malloc(size);
+	if (!buf || fb_create(&view)) {
+		error("out of memory");
+		return 2;
+	}
+	fd = mkstemp(tmpl);
+	if (fd == -1) {
+		error("%s: %s", tmpl, strerror(errno));
+		return 2;
+	}
+	unlink(tmpl);
+	pool = pool_new(0);
+
+	printf("corpus %zu bytes, block %zu bytes, graph %ux%u\n", size, blk, width, height);
+	for (i = 0; i < countof(corpora); ++i) {
+		struct input in = {
+			.pfd = { .fd = fd },
+			.input_size = blk,
+			.bufsize = sizeof(in.buf),
+		};
+
+		corpora[i].gen(buf, size);
+		if (ftruncate(fd, 0) == -1 ||
+		    pwrite(fd, buf, size, 0) != (ssize_t)size) {
+			error("%s: %s", tmpl, strerror(errno));
+			return 2;
+		}
+		bench_kernels(buf, size, corpora[i].name);
+		if (input_map(&in) == 0)
+			for (g = 0; g < countof(graphs); ++g)
+				bench_graph(graphs[g], &view, &in, "mmap",
+					    corpora[i].name, size, blk);
+		if (in.map)
+			munmap((void *)in.map, in.map_size);
+		in.map = NULL;
+		for (g = 0; g < countof(graphs); ++g)
+			bench_graph(graphs[g], &view, &in, "read",
+				    corpora[i].name, size, blk);
+	}
+	close(fd);
+	pool_free(pool);
+	fb_destroy(&view);
+	free(buf);
+	return 0;
+}
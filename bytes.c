@@ -5,15 +5,34 @@
 #include <stdlib.h>
 #include "utils.h"
 #include "rawview.h"
+#include "classify.h"
+#include "pool.h"
 
-static off_t offset;
-static size_t blk_size;
+/* bytes classified per step of analyze() */
+#define CLASSIFY_CHUNK (4096)
+/* large buffers are classified on the pool in parts at least this large */
+#define CLASSIFY_PART_MIN (256 * 1024)
+/* classes kept of a block for redrawing it */
+#define KEEP_MAX (16 * 1024 * 1024)
 
-static unsigned byte_width;
-static unsigned bytes_per_row;
-static unsigned byte_height;
-static unsigned vert_fill, vert_step;
-static int blk_left, blk_x, blk_y, blk_row, blk_col;
+const struct byte_classes *bytes_classes = &ascii_classes;
+
+struct bytes
+{
+	off_t offset;
+	size_t blk_size;
+
+	unsigned byte_width;
+	unsigned bytes_per_row;
+	unsigned byte_height;
+	unsigned vert_fill, vert_step;
+	int blk_left, blk_x, blk_y, blk_row, blk_col;
+	unsigned blk_row_height;
+
+	/* the classes of the block so far, as long as they fit into KEEP_MAX */
+	uint8_t *kept;
+	size_t kept_size, kept_len, analyzed;
+};
 
 static inline unsigned sub0(unsigned a, unsigned b)
 {
@@ -22,8 +41,9 @@ static inline unsigned sub0(unsigned a, unsigned b)
 
 static unsigned calc_bytes_per_row(struct window *view, unsigned bw)
 {
-	unsigned bpr = (unsigned)(view->graph_area.width - blk_left) / bw;
-	unsigned undrawn_line_part = (unsigned)(view->graph_area.width - blk_left) - bpr * bw;
+	const struct bytes *st = view->priv;
+	unsigned bpr = (unsigned)(view->graph_area.width - st->blk_left) / bw;
+	unsigned undrawn_line_part = (unsigned)(view->graph_area.width - st->blk_left) - bpr * bw;
 	if (undrawn_line_part > 4)
 		bpr++;
 	/* allow no incomplete rows */
@@ -32,39 +52,40 @@ static unsigned calc_bytes_per_row(struct window *view, unsigned bw)
 	return bpr;
 }
 
-static unsigned calc_graph_rows(unsigned bpr)
+static unsigned calc_graph_rows(const struct bytes *st, unsigned bpr)
 {
-	return blk_size / bpr + !!(blk_size % bpr);
+	return st->blk_size / bpr + !!(st->blk_size % bpr);
 }
 
-static unsigned calc_graph_height(unsigned bh, unsigned bpr)
+static unsigned calc_graph_height(const struct bytes *st, unsigned bh, unsigned bpr)
 {
-	return calc_graph_rows(bpr) * bh;
+	return calc_graph_rows(st, bpr) * bh;
 }
 
 static void layout(struct window *view)
 {
+	struct bytes *st = view->priv;
 	unsigned max_bytes;
 
-	blk_left = 1; // view->graph_area.width / 2 + 1;
-	max_bytes = (unsigned)(view->graph_area.width - blk_left) * view->graph_area.height;
-	byte_width = 1;
-	byte_height = 1;
-	bytes_per_row = calc_bytes_per_row(view, byte_width);
-	vert_fill = 0;
-	vert_step = 0;
+	st->blk_left = 1; // view->graph_area.width / 2 + 1;
+	max_bytes = (unsigned)(view->graph_area.width - st->blk_left) * view->graph_area.height;
+	st->byte_width = 1;
+	st->byte_height = 1;
+	st->bytes_per_row = calc_bytes_per_row(view, st->byte_width);
+	st->vert_fill = 0;
+	st->vert_step = 0;
 
 	trace_if(2, "%s: bw %u bh %u bpr %u blk %u max %u\n", __func__,
-	      byte_width, byte_width, bytes_per_row, blk_size, max_bytes);
-	if (blk_size >= max_bytes)
+	      st->byte_width, st->byte_width, st->bytes_per_row, st->blk_size, max_bytes);
+	if (st->blk_size >= max_bytes)
 		return;
 	for (;;) {
-		unsigned bw = byte_width + 1;
-		unsigned bh = byte_height + 1;
+		unsigned bw = st->byte_width + 1;
+		unsigned bh = st->byte_height + 1;
 		unsigned bpr = calc_bytes_per_row(view, bw);
-		//bw = (unsigned)(view->graph_area.width - blk_left) / bpr;
-		unsigned nrows = calc_graph_rows(bpr);
-		unsigned h = calc_graph_height(bh, bpr);
+		//bw = (unsigned)(view->graph_area.width - st->blk_left) / bpr;
+		unsigned nrows = calc_graph_rows(st, bpr);
+		unsigned h = calc_graph_height(st, bh, bpr);
 		unsigned vf = view->graph_area.height - h;
 		unsigned vs = vf / nrows + 1;
 
@@ -75,147 +96,271 @@ static void layout(struct window *view)
 		      view->graph_area.height);
 		if (h > view->graph_area.height)
 			break;
-		byte_width = bw;
-		byte_height = bh;
-		bytes_per_row = bpr;
-		vert_fill = vf;
-		vert_step = vs;
+		st->byte_width = bw;
+		st->byte_height = bh;
+		st->bytes_per_row = bpr;
+		st->vert_fill = vf;
+		st->vert_step = vs;
 	}
 }
 
+static inline unsigned calc_row_height(struct bytes *st, unsigned row)
+{
+	unsigned h = st->byte_height + st->vert_step;
+	if (st->vert_fill)
+		st->vert_fill -= st->vert_step;
+	else
+		st->vert_step = 0;
+	return h;
+}
+
+static void start_position(struct window *view)
+{
+	struct bytes *st = view->priv;
+
+	st->blk_x = 0;
+	st->blk_y = 0;
+	st->blk_row = 0;
+	st->blk_col = 0;
+	st->vert_fill = sub0(view->graph_area.height, calc_graph_height(st, st->byte_height, st->bytes_per_row));
+	st->vert_step = st->vert_fill / calc_graph_rows(st, st->bytes_per_row) + 1;
+	st->blk_row_height = calc_row_height(st, st->blk_row);
+	fb_fill(view, 0 /* blk_left */, 0, view->graph_area.width /* - blk_left */, view->graph_area.height, GRAPH_BG);
+}
+
 static void start_block(struct window *view, off_t off)
 {
-	offset = off;
-	blk_x = 0;
-	blk_y = 0;
-	blk_row = 0;
-	blk_col = 0;
-	vert_fill = sub0(view->graph_area.height, calc_graph_height(byte_height, bytes_per_row));
-	vert_step = vert_fill / calc_graph_rows(bytes_per_row) + 1;
-	xcb_change_gc(view->c, view->graph, XCB_GC_FOREGROUND, &view->colors.graph_bg);
-	xcb_rectangle_t rect = { 0 /* blk_left */, 0, view->graph_area.width /* - blk_left */, view->graph_area.height };
-	xcb_poly_fill_rectangle(view->c, view->graph_pid, view->graph, 1, &rect);
+	struct bytes *st = view->priv;
+
+	st->offset = off;
+	st->kept_len = 0;
+	st->analyzed = 0;
+	start_position(view);
 
 	trace("%s: file off %lld\n", __func__, (long long)off);
 }
 
-static uint32_t classify(struct window *view, uint8_t byte)
-{
-	switch (byte) {
-	case 0:
-		return view->colors.graph_bg;
-	case '\x20':
-	case '\t': /* white space */
-		return view->colors.graph_fg[0];
-	case 1 ... 8:
-	case 11: // VT
-	case 12: // FF
-	case 14 ... 31: /* control chars */
-		return view->colors.graph_fg[1];
-	case '\r':
-	case '\n':
-		return view->colors.graph_fg[2];
-	case '0' ... '9':
-		return view->colors.graph_fg[3];
-	case 'A' ... 'Z':
-	case 'a' ... 'z':
-	case '_':
-		return view->colors.graph_fg[4];
-	case '!' ... '/':
-	case ':' ... '@':
-	case '[' ... '^':
-	case '`':
-	case '{' ... '~':
-		return view->colors.graph_fg[5];
-	case 127: /* DEL */
-		return view->colors.graph_fg[8];
-	case 128 ... 255:
-		return view->colors.graph_fg[9];
+/* draw n classified bytes at the current position, all in the same row */
+static void draw_run(struct window *view, const uint8_t cls[], unsigned n,
+		     unsigned row_height)
+{
+	struct bytes *st = view->priv;
+	struct framebuffer *fb = &view->fb;
+	unsigned x0 = st->blk_left + st->blk_x, x1 = x0 + n * st->byte_width;
+	unsigned i, x, y, y1 = st->blk_y + row_height;
+	uint8_t *row;
+
+	if (x1 > fb->width)
+		x1 = fb->width;
+	if (y1 > fb->height)
+		y1 = fb->height;
+	if (x0 >= x1 || st->blk_y >= y1)
+		return;
+	row = fb_row(fb, st->blk_y);
+	if (st->byte_width == 1)
+		memcpy(row + x0, cls, x1 - x0);
+	else
+		for (i = 0, x = x0; x < x1; ++i) {
+			unsigned e = x + st->byte_width < x1 ? x + st->byte_width : x1;
+
+			memset(row + x, cls[i], e - x);
+			x = e;
+		}
+	for (y = st->blk_y + 1; y < y1; ++y)
+		memcpy(fb_row(fb, y) + x0, row + x0, x1 - x0);
+	fb_dirty(fb, st->blk_y, y1);
+}
+
+/* draw n classes from the current position on, n is at most a chunk */
+static void draw_classes(struct window *view, const uint8_t cls[], unsigned n)
+{
+	struct bytes *st = view->priv;
+	unsigned i, run;
+	unsigned row_height = st->blk_row_height;
+
+	for (i = 0; i < n; i += run) {
+		run = st->bytes_per_row - st->blk_col;
+		if (run > n - i)
+			run = n - i;
+		draw_run(view, cls + i, run, row_height);
+		st->blk_x += run * st->byte_width;
+		st->blk_col += run;
+		if (st->blk_col == st->bytes_per_row) {
+			st->blk_x = 0;
+			st->blk_y += row_height;
+			row_height = st->blk_row_height = calc_row_height(st, ++st->blk_row);
+			st->blk_col = 0;
+			trace_if(3, "row %u (%u, %u, vert %u a %u)\n", st->blk_row,
+				 st->byte_height, row_height, st->vert_fill, st->vert_step);
+		}
 	}
-	return view->colors.graph_fg[7];
 }
 
-static inline unsigned calc_row_height(unsigned row)
+/* make the unused part of the graph area visible */
+static void fill_unused(struct window *view)
 {
-	unsigned h = byte_height + vert_step;
-	if (vert_fill)
-		vert_fill -= vert_step;
-	else
-		vert_step = 0;
-	return h;
+	const struct bytes *st = view->priv;
+	unsigned width = st->bytes_per_row * st->byte_width;
+
+	fb_fill(view, st->blk_left + st->blk_x, st->blk_y, width - st->blk_x, st->blk_row_height, GRAPH_FG(6));
+	fb_fill(view, st->blk_left, st->blk_y + st->blk_row_height, width,
+		sub0(view->graph_area.height, st->blk_y + st->blk_row_height), GRAPH_FG(6));
+}
+
+/* at least as many bytes as are still visible from the current position */
+static size_t visible_bytes(struct window *view)
+{
+	const struct bytes *st = view->priv;
+	size_t rows;
+
+	if (st->blk_y >= view->graph_area.height)
+		return 0;
+	rows = (view->graph_area.height - st->blk_y) / st->byte_height + 1;
+	return rows * st->bytes_per_row - st->blk_col;
+}
+
+struct classify_job
+{
+	const uint8_t *src;
+	uint8_t *dst;
+	size_t count, part_size;
+	unsigned nparts;
+};
+
+static void classify_part(void *arg, unsigned i)
+{
+	struct classify_job *job = arg;
+	size_t off = i * job->part_size;
+	size_t n = i == job->nparts - 1 ? job->count - off : job->part_size;
+
+	classify_bytes(bytes_classes, job->dst + off, job->src + off, n);
+}
+
+/*
+ * The visible part of a large buffer is classified into the kept classes
+ * on the pool, every thread its own range of them, and drawn from there.
+ * Returns how much of buf it took, 0 if it was not worth it.
+ */
+static size_t classify_pool(struct window *view, const uint8_t buf[], size_t count)
+{
+	struct bytes *st = view->priv;
+	struct classify_job job = { .src = buf };
+	unsigned n = pool_threads(view->pool);
+	size_t i, len;
+
+	if (st->kept_len != st->analyzed)
+		return 0;
+	if (count > visible_bytes(view))
+		count = visible_bytes(view);
+	if (count > st->kept_size - st->kept_len)
+		count = st->kept_size - st->kept_len;
+	if (n > count / CLASSIFY_PART_MIN)
+		n = count / CLASSIFY_PART_MIN;
+	if (n < 2)
+		return 0;
+	job.dst = st->kept + st->kept_len;
+	job.count = count;
+	job.part_size = count / n;
+	job.nparts = n;
+	pool_run(view->pool, n, classify_part, &job);
+	for (i = 0; i < count; i += len) {
+		len = count - i < CLASSIFY_CHUNK ? count - i : CLASSIFY_CHUNK;
+		draw_classes(view, job.dst + i, len);
+	}
+	st->kept_len += count;
+	st->analyzed += count;
+	return count;
 }
 
-static void analyze(struct window *view, uint8_t buf[], size_t count)
-{
-	xcb_rectangle_t rect;
-	xcb_rectangle_t rts[BUFSIZ / sizeof(xcb_rectangle_t)];
-	unsigned i, o;
-	uint32_t curclr = view->colors.graph_fg[0];
-	unsigned row_height = calc_row_height(blk_row);
-
-	trace_if(2,"row %u (bh %u, rh %u, vert %u a %u)\n", blk_row,
-		 byte_height, row_height, vert_fill, vert_step);
-	xcb_change_gc(view->c, view->graph, XCB_GC_FOREGROUND, &curclr);
-
-	for (i = o = 0; i < count; ++i) {
-		uint32_t clr = classify(view, buf[i]);
-
-		rts[o].x = blk_left + blk_x;
-		rts[o].y = blk_y;
-		rts[o].width = byte_width;
-		rts[o].height = row_height;
-		blk_x += byte_width;
-		if (++blk_col == bytes_per_row) {
-			blk_x = 0;
-			blk_y += row_height;
-			row_height = calc_row_height(++blk_row);
-			blk_col = 0;
-			trace_if(3, "row %u (%u, %u, vert %u a %u)\n", blk_row,
-				 byte_height, row_height, vert_fill, vert_step);
+static void analyze(struct window *view, const uint8_t buf[], size_t count)
+{
+	struct bytes *st = view->priv;
+	uint8_t chunk[CLASSIFY_CHUNK];
+	size_t n;
+
+	trace_if(2,"row %u (bh %u, rh %u, vert %u a %u)\n", st->blk_row,
+		 st->byte_height, st->blk_row_height, st->vert_fill, st->vert_step);
+
+	n = classify_pool(view, buf, count);
+	for (buf += n, count -= n; count; buf += n, count -= n) {
+		uint8_t *cls = chunk;
+
+		/* nothing of the rest of the block will be visible */
+		if (st->blk_y >= view->graph_area.height) {
+			st->analyzed += count;
+			return;
 		}
-		++o;
-		if (curclr != clr || o == countof(rts)) {
-			if (curclr != clr) {
-				curclr = clr;
-				xcb_change_gc(view->c, view->graph, XCB_GC_FOREGROUND, &curclr);
-			}
-			xcb_poly_fill_rectangle(view->c, view->graph_pid, view->graph, o, rts);
-			o = 0;
+		n = count < CLASSIFY_CHUNK ? count : CLASSIFY_CHUNK;
+		if (st->kept_len == st->analyzed && st->kept_len + n <= st->kept_size) {
+			cls = st->kept + st->kept_len;
+			st->kept_len += n;
 		}
+		st->analyzed += n;
+		classify_bytes(bytes_classes, cls, buf, n);
+		draw_classes(view, cls, n);
 	}
-	if (o)
-		xcb_poly_fill_rectangle(view->c, view->graph_pid, view->graph, o, rts);
-
-	/* make the unused part of the graph area visible */
-	xcb_change_gc(view->c, view->graph, XCB_GC_FOREGROUND, view->colors.graph_fg + 6);
-	rect.x = blk_left + blk_x;
-	rect.y = blk_y;
-	rect.width = bytes_per_row * byte_width - blk_x;
-	rect.height = row_height;
-	if (rect.width)
-		xcb_poly_fill_rectangle(view->c, view->graph_pid, view->graph, 1, &rect);
-	rect.x = blk_left;
-	rect.y += rect.height;
-	rect.width = bytes_per_row * byte_width;
-	if (view->graph_area.height > rect.y) {
-		rect.height = view->graph_area.height - rect.y;
-		xcb_poly_fill_rectangle(view->c, view->graph_pid, view->graph, 1, &rect);
+	fill_unused(view);
+}
+
+/* lay the kept classes out again, for the new graph size */
+static int redraw(struct window *view)
+{
+	struct bytes *st = view->priv;
+	size_t i;
+	unsigned n;
+
+	if (st->kept_len != st->analyzed)
+		return 0;
+	start_position(view);
+	for (i = 0; i < st->kept_len && st->blk_y < view->graph_area.height; i += n) {
+		n = st->kept_len - i < CLASSIFY_CHUNK ? st->kept_len - i : CLASSIFY_CHUNK;
+		draw_classes(view, st->kept + i, n);
 	}
+	fill_unused(view);
+	return 1;
 }
 
 static void setup(struct window *view, size_t blk)
 {
+	struct bytes *st = graph_priv(view, sizeof(struct bytes));
+
 	trace("%s: blk %u\n", __func__, blk);
-	blk_size = blk;
+	if (blk != st->blk_size) {
+		size_t size = blk < KEEP_MAX ? blk : KEEP_MAX;
+		uint8_t *p = realloc(st->kept, size);
+
+		if (!p)
+			free(st->kept);
+		st->kept = p;
+		st->kept_size = p ? size : 0;
+		st->kept_len = 0;
+		st->analyzed = 0;
+	}
+	st->blk_size = blk;
 	layout(view);
 }
 
+static void destroy(struct window *view)
+{
+	struct bytes *st = view->priv;
+
+	if (st)
+		free(st->kept);
+	free(st);
+	view->priv = NULL;
+}
+
 struct graph_desc bytes_graph = {
 	.name = "bytes",
 	.width = 256,
 	.height = 512,
+	/* the left margin and a byte */
+	.min_width = 2,
+	.min_height = 1,
 	.start_block = start_block,
 	.setup = setup,
 	.analyze = analyze,
+	.redraw = redraw,
+	.destroy = destroy,
 };
 
@@ -0,0 +1,114 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rawview.h"
+#include "cache.h"
+
+struct cache_entry
+{
+	struct cache_entry *prev, *next;
+	struct block_key key;
+	size_t size;
+	uint8_t pix[];
+};
+
+static int same_key(const struct block_key *a, const struct block_key *b)
+{
+	return a->graph == b->graph && a->offset == b->offset && a->size == b->size &&
+		a->width == b->width && a->height == b->height;
+}
+
+static void unlink_entry(struct block_cache *cache, struct cache_entry *e)
+{
+	if (e->prev)
+		e->prev->next = e->next;
+	else
+		cache->mru = e->next;
+	if (e->next)
+		e->next->prev = e->prev;
+	else
+		cache->lru = e->prev;
+}
+
+static void push_entry(struct block_cache *cache, struct cache_entry *e)
+{
+	e->prev = NULL;
+	e->next = cache->mru;
+	if (cache->mru)
+		cache->mru->prev = e;
+	else
+		cache->lru = e;
+	cache->mru = e;
+}
+
+static void drop_entry(struct block_cache *cache, struct cache_entry *e)
+{
+	unlink_entry(cache, e);
+	cache->used -= e->size;
+	free(e);
+}
+
+/* only a handful of blocks fit, a list walk is cheap next to a render */
+static struct cache_entry *find(struct block_cache *cache, const struct block_key *key)
+{
+	struct cache_entry *e;
+
+	for (e = cache->mru; e; e = e->next)
+		if (same_key(&e->key, key))
+			return e;
+	return NULL;
+}
+
+int cache_lookup(struct block_cache *cache, const struct block_key *key,
+		 struct framebuffer *fb)
+{
+	struct cache_entry *e = find(cache, key);
+
+	if (!e || key->width != fb->width || key->height != fb->height) {
+		cache->misses++;
+		return 0;
+	}
+	cache->hits++;
+	unlink_entry(cache, e);
+	push_entry(cache, e);
+	memcpy(fb->pix, e->pix, (size_t)fb->width * fb->height);
+	fb_dirty(fb, 0, fb->height);
+	trace("%s: %s %lld+%lu hit (%lu/%lu)\n", __func__, key->graph,
+	      (long long)key->offset, (unsigned long)key->size, cache->hits, cache->misses);
+	return 1;
+}
+
+int cache_has(struct block_cache *cache, const struct block_key *key)
+{
+	return find(cache, key) != NULL;
+}
+
+void cache_store(struct block_cache *cache, const struct block_key *key,
+		 const struct framebuffer *fb)
+{
+	size_t size = sizeof(struct cache_entry) + (size_t)fb->width * fb->height;
+	struct cache_entry *e = find(cache, key);
+
+	if (e)
+		drop_entry(cache, e);
+	if (size > cache->cap)
+		return;
+	while (cache->used + size > cache->cap)
+		drop_entry(cache, cache->lru);
+	e = malloc(size);
+	if (!e)
+		return;
+	e->key = *key;
+	e->key.width = fb->width;
+	e->key.height = fb->height;
+	e->size = size;
+	memcpy(e->pix, fb->pix, (size_t)fb->width * fb->height);
+	push_entry(cache, e);
+	cache->used += size;
+}
+
+void cache_clear(struct block_cache *cache)
+{
+	while (cache->lru)
+		drop_entry(cache, cache->lru);
+}
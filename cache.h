@@ -0,0 +1,38 @@
+#ifndef _CACHE_H_
+#define _CACHE_H_ 1
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "fb.h"
+
+/* default memory for rendered blocks, -M */
+#define CACHE_DEFAULT_MB (64)
+
+struct block_key
+{
+	const char *graph;
+	off_t offset;
+	size_t size;
+	unsigned width, height;
+};
+
+struct cache_entry;
+
+/*
+ * Rendered graphs of recently viewed blocks, least recently used ones are
+ * dropped to stay within cap bytes.
+ */
+struct block_cache
+{
+	struct cache_entry *mru, *lru;
+	size_t used, cap;
+	unsigned long hits, misses;
+};
+
+int cache_lookup(struct block_cache *, const struct block_key *, struct framebuffer *);
+/* whether the block is there, without counting or touching it */
+int cache_has(struct block_cache *, const struct block_key *);
+void cache_store(struct block_cache *, const struct block_key *, const struct framebuffer *);
+void cache_clear(struct block_cache *);
+
+#endif /* _CACHE_H_ */
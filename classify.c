@@ -0,0 +1,188 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include "utils.h"
+#include "fb.h"
+#include "classify.h"
+
+const struct byte_classes ascii_classes = {
+	.name = "ascii",
+	.cls = {
+		[0] = GRAPH_BG,
+		['\x20'] = GRAPH_FG(0),
+		['\t'] = GRAPH_FG(0), /* white space */
+		[1 ... 8] = GRAPH_FG(1),
+		[11] = GRAPH_FG(1), // VT
+		[12] = GRAPH_FG(1), // FF
+		[14 ... 31] = GRAPH_FG(1), /* control chars */
+		['\r'] = GRAPH_FG(2),
+		['\n'] = GRAPH_FG(2),
+		['0' ... '9'] = GRAPH_FG(3),
+		['A' ... 'Z'] = GRAPH_FG(4),
+		['a' ... 'z'] = GRAPH_FG(4),
+		['_'] = GRAPH_FG(4),
+		['!' ... '/'] = GRAPH_FG(5),
+		[':' ... '@'] = GRAPH_FG(5),
+		['[' ... '^'] = GRAPH_FG(5),
+		['`'] = GRAPH_FG(5),
+		['{' ... '~'] = GRAPH_FG(5),
+		[127] = GRAPH_FG(8), /* DEL */
+		[128 ... 255] = GRAPH_FG(9),
+	},
+};
+
+const struct byte_classes utf8_classes = {
+	.name = "utf8",
+	.cls = {
+		[0] = GRAPH_BG,
+		[1 ... 31] = GRAPH_FG(1),
+		['\t'] = GRAPH_FG(0),
+		['\n'] = GRAPH_FG(0),
+		['\r'] = GRAPH_FG(0),
+		['\x20'] = GRAPH_FG(0),
+		['!' ... '~'] = GRAPH_FG(4),
+		[127] = GRAPH_FG(8),
+		[0x80 ... 0xbf] = GRAPH_FG(5), /* continuation */
+		[0xc0 ... 0xc1] = GRAPH_FG(9), /* overlong */
+		[0xc2 ... 0xdf] = GRAPH_FG(3), /* 2 byte sequence */
+		[0xe0 ... 0xef] = GRAPH_FG(7), /* 3 byte sequence */
+		[0xf0 ... 0xf4] = GRAPH_FG(2), /* 4 byte sequence */
+		[0xf5 ... 0xff] = GRAPH_FG(9), /* never valid */
+	},
+};
+
+const struct byte_classes x86_classes = {
+	.name = "x86",
+	.cls = {
+		[0] = GRAPH_BG,
+		[1 ... 255] = GRAPH_FG(0),
+		[0x26] = GRAPH_FG(1), /* segment overrides */
+		[0x2e] = GRAPH_FG(1),
+		[0x36] = GRAPH_FG(1),
+		[0x3e] = GRAPH_FG(1),
+		[0x64] = GRAPH_FG(1),
+		[0x65] = GRAPH_FG(1),
+		[0x66] = GRAPH_FG(2), /* operand/address size */
+		[0x67] = GRAPH_FG(2),
+		[0xf0] = GRAPH_FG(3), /* lock, repne, rep */
+		[0xf2] = GRAPH_FG(3),
+		[0xf3] = GRAPH_FG(3),
+		[0x40 ... 0x4f] = GRAPH_FG(4), /* REX */
+		[0x0f] = GRAPH_FG(5), /* two byte opcode escape */
+		[0xc4] = GRAPH_FG(7), /* VEX, EVEX */
+		[0xc5] = GRAPH_FG(7),
+		[0x62] = GRAPH_FG(7),
+		[0xe8] = GRAPH_FG(8), /* call, jmp, ret */
+		[0xe9] = GRAPH_FG(8),
+		[0xeb] = GRAPH_FG(8),
+		[0xc3] = GRAPH_FG(8),
+		[0x90] = GRAPH_FG(9), /* nop, int3 padding */
+		[0xcc] = GRAPH_FG(9),
+	},
+};
+
+static const struct byte_classes *const class_sets[] = {
+	&ascii_classes,
+	&utf8_classes,
+	&x86_classes,
+};
+
+const struct byte_classes *find_byte_classes(const char *name)
+{
+	unsigned i;
+
+	for (i = 0; i < countof(class_sets); ++i)
+		if (strcasecmp(name, class_sets[i]->name) == 0)
+			return class_sets[i];
+	return NULL;
+}
+
+static int read_classes(FILE *fp, uint8_t cls[256])
+{
+	char line[1024];
+	unsigned n = 0;
+
+	while (fgets(line, sizeof(line), fp)) {
+		char *p = line, *end;
+
+		if (!strchr(line, '\n') && !feof(fp))
+			return -1; /* too long */
+		line[strcspn(line, "#")] = '\0';
+		for (;;) {
+			unsigned long c;
+
+			while (isspace((unsigned char)*p))
+				++p;
+			if (!*p)
+				break;
+			c = strtoul(p, &end, 0);
+			if (end == p || !(isspace((unsigned char)*end) || !*end) ||
+			    c >= GRAPH_COLORS || n == 256)
+				return -1;
+			cls[n++] = c;
+			p = end;
+		}
+	}
+	return ferror(fp) || n != 256 ? -1 : 0;
+}
+
+const struct byte_classes *load_byte_classes(const char *path)
+{
+	struct byte_classes *bc = calloc(1, sizeof(*bc));
+	FILE *fp;
+	int ret;
+
+	if (!bc)
+		return NULL;
+	fp = fopen(path, "r");
+	if (!fp)
+		goto fail;
+	errno = 0;
+	ret = read_classes(fp, bc->cls);
+	if (ret && !errno)
+		errno = EINVAL;
+	fclose(fp);
+	if (ret)
+		goto fail;
+	/* views started with -C find it again */
+	bc->name = strdup(path);
+	if (!bc->name)
+		goto fail;
+	return bc;
+fail:
+	free(bc);
+	return NULL;
+}
+
+/*
+ * Map src to class indices in one pass. Eight bytes are loaded at once and
+ * looked up in the table; a pshufb based lookup needs 16 shuffles per
+ * vector for an arbitrary 256 entry table and is slower than this.
+ */
+void classify_bytes(const struct byte_classes *bc, uint8_t dst[],
+		    const uint8_t src[], size_t count)
+{
+	const uint8_t *cls = bc->cls;
+	size_t i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		uint64_t v, o;
+
+		memcpy(&v, src + i, sizeof(v));
+		o = (uint64_t)cls[v & 0xff] |
+			(uint64_t)cls[(v >> 8) & 0xff] << 8 |
+			(uint64_t)cls[(v >> 16) & 0xff] << 16 |
+			(uint64_t)cls[(v >> 24) & 0xff] << 24 |
+			(uint64_t)cls[(v >> 32) & 0xff] << 32 |
+			(uint64_t)cls[(v >> 40) & 0xff] << 40 |
+			(uint64_t)cls[(v >> 48) & 0xff] << 48 |
+			(uint64_t)cls[v >> 56] << 56;
+		memcpy(dst + i, &o, sizeof(o));
+	}
+	for (; i < count; ++i)
+		dst[i] = cls[src[i]];
+}
@@ -0,0 +1,28 @@
+#ifndef _CLASSIFY_H_
+#define _CLASSIFY_H_ 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* palette index (GRAPH_BG, GRAPH_FG(n)) of every byte value */
+struct byte_classes
+{
+	const char *name;
+	uint8_t cls[256];
+};
+
+extern const struct byte_classes ascii_classes;
+extern const struct byte_classes utf8_classes;
+extern const struct byte_classes x86_classes;
+
+const struct byte_classes *find_byte_classes(const char *name);
+/*
+ * A table of the user's, named after the file: 256 palette indices in
+ * byte order, separated by white space, '#' comments to the end of the
+ * line. Returns NULL with errno, EINVAL if it is not such a table.
+ */
+const struct byte_classes *load_byte_classes(const char *path);
+void classify_bytes(const struct byte_classes *, uint8_t dst[],
+		    const uint8_t src[], size_t count);
+
+#endif /* _CLASSIFY_H_ */
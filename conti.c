@@ -5,97 +5,122 @@
 #include <stdlib.h>
 #include "utils.h"
 #include "rawview.h"
+#include "hist.h"
 
-static uint8_t conti[256][256];
+struct conti
+{
+	uint32_t conti[BIGRAMS];
+	int last_byte;
+};
 
 static void start_block(struct window *view, off_t off)
 {
-	uint32_t mask = XCB_GC_FOREGROUND;
-	uint32_t values[] = { view->colors.graph_bg };
-	xcb_rectangle_t graph = { 0, 0, view->graph_area.width, view->graph_area.height };
+	struct conti *st = view->priv;
 
-	xcb_change_gc(view->c, view->graph, mask, values);
-	xcb_poly_fill_rectangle(view->c, view->graph_pid, view->graph, 1, &graph);
-	memset(conti, 0, sizeof(conti));
+	fb_fill(view, 0, 0, view->graph_area.width, view->graph_area.height, GRAPH_BG);
+	memset(st->conti, 0, sizeof(st->conti));
+	st->last_byte = -1;
 }
 
-static void analyze_points(struct window *view, uint8_t buf[], size_t count)
+static void analyze(struct window *view, const uint8_t buf[], size_t count)
 {
-	xcb_point_t pts[BUFSIZ / sizeof(xcb_point_t)];
-	unsigned i, o = 0;
-	uint32_t curclr = view->colors.graph_fg[0];
-
-	xcb_change_gc(view->c, view->graph, XCB_GC_FOREGROUND, &curclr);
-	for (i = 1; i < count; ++i) {
-		uint32_t clr;
-		unsigned cnt = conti[buf[i - 1]][buf[i]];
-
-		if (cnt < 255)
-			conti[buf[i - 1]][buf[i]] = ++cnt;
-		clr = view->colors.graph_fg[countof(view->colors.graph_fg) * cnt / 256];
-		pts[o].x = buf[i - 1] * view->graph_area.width / 256;
-		pts[o].y = buf[i] * view->graph_area.height / 256;
-		++o;
-		if (curclr != clr || o == countof(pts)) {
-			if (curclr != clr) {
-				curclr = clr;
-				xcb_change_gc(view->c, view->graph, XCB_GC_FOREGROUND, &curclr);
-			}
-			xcb_poly_point(view->c, XCB_COORD_MODE_ORIGIN, view->graph_pid, view->graph, o, pts);
-			o = 0;
-		}
+	struct conti *st = view->priv;
+
+	if (!count)
+		return;
+	if (st->last_byte >= 0) {
+		uint32_t *c = &st->conti[BIGRAM(st->last_byte, buf[0])];
+
+		*c = bigram_sat(*c, 1);
 	}
-	if (o) {
-		xcb_poly_point(view->c, XCB_COORD_MODE_ORIGIN, view->graph_pid, view->graph, o, pts);
+	bigram_count_pool(view->pool, st->conti, buf, count);
+	st->last_byte = buf[count - 1];
+}
+
+/* the bigrams of a whole block, put together without reading it */
+static void add_bigrams(struct window *view, const uint32_t hist[], uint8_t last)
+{
+	struct conti *st = view->priv;
+
+	bigram_add(st->conti, hist);
+	/* a followed file goes on after it */
+	st->last_byte = last;
+}
+
+static inline uint8_t count_color(uint32_t cnt)
+{
+	if (cnt > 255)
+		cnt = 255;
+	return GRAPH_FG(GRAPH_FG_COLORS * cnt / 256);
+}
+
+static void render_points(struct window *view)
+{
+	const struct conti *st = view->priv;
+	struct framebuffer *fb = &view->fb;
+	unsigned a, b;
+
+	fb_dirty(fb, 0, fb->height);
+	for (a = 0; a < 256; ++a) {
+		unsigned x = a * view->graph_area.width / 256;
+
+		for (b = 0; b < 256; ++b) {
+			uint32_t cnt = st->conti[BIGRAM(a, b)];
+
+			if (cnt)
+				fb_row(fb, b * view->graph_area.height / 256)[x] = count_color(cnt);
+		}
 	}
 }
 
-static void analyze_rects(struct window *view, uint8_t buf[], size_t count)
+static void render_rects(struct window *view)
 {
-	xcb_rectangle_t rts[BUFSIZ / sizeof(xcb_rectangle_t)];
-	unsigned i, o = 0;
-	uint32_t curclr = view->colors.graph_fg[0];
+	const struct conti *st = view->priv;
+	unsigned a, b;
 	int16_t w = view->graph_area.width / 256, h = view->graph_area.height / 256;
 
 	if (w < 1)
 		w = 1;
 	if (h < 1)
 		h = 1;
-	xcb_change_gc(view->c, view->graph, XCB_GC_FOREGROUND, &curclr);
-	for (i = 1; i < count; ++i) {
-		uint32_t clr;
-		unsigned cnt = conti[buf[i - 1]][buf[i]];
-
-		if (cnt < 255)
-			conti[buf[i - 1]][buf[i]] = ++cnt;
-		clr = view->colors.graph_fg[countof(view->colors.graph_fg) * cnt / 256];
-		rts[o].x = buf[i - 1] * view->graph_area.width / 256;
-		rts[o].y = buf[i] * view->graph_area.height / 256;
-		rts[o].width = w + 1;
-		rts[o].height = h + 1;
-		if (curclr != clr || ++o == countof(rts)) {
-			if (curclr != clr) {
-				curclr = clr;
-				xcb_change_gc(view->c, view->graph, XCB_GC_FOREGROUND, &curclr);
-			}
-			xcb_poly_fill_rectangle(view->c, view->graph_pid, view->graph, o, rts);
-			o = 0;
+	for (a = 0; a < 256; ++a)
+		for (b = 0; b < 256; ++b) {
+			uint32_t cnt = st->conti[BIGRAM(a, b)];
+
+			if (cnt)
+				fb_fill(view,
+					a * view->graph_area.width / 256,
+					b * view->graph_area.height / 256,
+					w + 1, h + 1, count_color(cnt));
 		}
-	}
-	if (o) {
-		xcb_poly_fill_rectangle(view->c, view->graph_pid, view->graph, o, rts);
-	}
 }
 
-static void analyze(struct window *view, uint8_t buf[], size_t count)
+/* the counts are drawn in one pass over the table, not per input byte */
+static void render(struct window *view)
 {
 	if (view->graph_area.width > 256 || view->graph_area.height > 256)
-		analyze_rects(view, buf, count);
+		render_rects(view);
 	else
-		analyze_points(view, buf, count);
+		render_points(view);
 }
 
-static void setup(struct window *view, size_t blk) {}
+static void setup(struct window *view, size_t blk)
+{
+	graph_priv(view, sizeof(struct conti));
+}
+
+static void destroy(struct window *view)
+{
+	free(view->priv);
+	view->priv = NULL;
+}
+
+/* the counts do not depend on the graph size */
+static int redraw(struct window *view)
+{
+	fb_fill(view, 0, 0, view->graph_area.width, view->graph_area.height, GRAPH_BG);
+	return 1;
+}
 
 struct graph_desc conti_graph = {
 	.name = "conti",
@@ -104,4 +129,8 @@ struct graph_desc conti_graph = {
 	.setup = setup,
 	.start_block = start_block,
 	.analyze = analyze,
+	.render = render,
+	.redraw = redraw,
+	.add_bigrams = add_bigrams,
+	.destroy = destroy,
 };
@@ -0,0 +1,201 @@
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "utils.h"
+#include "rawview.h"
+
+/*
+ * Shannon entropy of the bytes in a window sliding over the block, in bits
+ * per byte. The window keeps its byte counts and the sum of c * log2(c)
+ * over them, so every byte entering and leaving it is O(1):
+ *   H = log2(n) - sum(c * log2(c)) / n
+ * Sums are fixed point with ENTROPY_FRAC bits, so they do not drift.
+ */
+#define ENTROPY_WINDOW (1024)
+#define ENTROPY_FRAC (16)
+#define ENTROPY_MAX (8u << ENTROPY_FRAC)
+/*
+ * The block is analyzed into a fixed number of bins, independent of the
+ * graph width; render() scales them to the columns.
+ */
+#define ENTROPY_BINS (4096)
+
+static uint32_t clogc[ENTROPY_WINDOW + 1];	/* c * log2(c) */
+static uint32_t log2n[ENTROPY_WINDOW + 1];	/* log2(n) */
+
+struct entropy
+{
+	uint8_t window[ENTROPY_WINDOW];
+	uint16_t counts[256];
+	unsigned win_size, win_fill, win_pos;
+	uint64_t win_sum;
+
+	/* mean entropy of the bytes of every bin */
+	uint32_t bins[ENTROPY_BINS];
+	unsigned bin;
+	size_t blk_size, blk_pos, bin_end;
+	uint64_t bin_full, bin_partial_n, bin_sum;
+	int64_t bin_partial;
+};
+
+static void make_tables(void)
+{
+	unsigned n;
+
+	for (n = 1; n <= ENTROPY_WINDOW; ++n) {
+		clogc[n] = lrint(n * log2(n) * (1 << ENTROPY_FRAC));
+		log2n[n] = lrint(log2(n) * (1 << ENTROPY_FRAC));
+	}
+}
+
+static void setup(struct window *view, size_t blk)
+{
+	struct entropy *st = graph_priv(view, sizeof(struct entropy));
+
+	if (!clogc[2])
+		make_tables();
+	st->blk_size = blk;
+	st->win_size = blk < ENTROPY_WINDOW ? blk : ENTROPY_WINDOW;
+	if (!st->win_size)
+		st->win_size = 1;
+}
+
+static void destroy(struct window *view)
+{
+	free(view->priv);
+	view->priv = NULL;
+}
+
+static size_t bin_end_pos(const struct entropy *st, unsigned b)
+{
+	return ((uint64_t)st->blk_size * (b + 1) + ENTROPY_BINS - 1) / ENTROPY_BINS;
+}
+
+static void start_block(struct window *view, off_t off)
+{
+	struct entropy *st = view->priv;
+
+	fb_fill(view, 0, 0, view->graph_area.width, view->graph_area.height, GRAPH_BG);
+	memset(st->counts, 0, sizeof(st->counts));
+	st->win_fill = 0;
+	st->win_pos = 0;
+	st->win_sum = 0;
+	memset(st->bins, 0, sizeof(st->bins));
+	st->bin = 0;
+	st->blk_pos = 0;
+	st->bin_end = bin_end_pos(st, 0);
+	st->bin_full = st->bin_partial = st->bin_partial_n = st->bin_sum = 0;
+}
+
+/* bins smaller than a byte repeat the last one */
+static void end_bin(struct entropy *st)
+{
+	uint64_t n = st->bin_full + st->bin_partial_n;
+	int64_t h;
+
+	if (n) {
+		h = st->bin_partial + (int64_t)(st->bin_full * log2n[st->win_size]) -
+			(int64_t)(st->bin_sum / st->win_size);
+		st->bins[st->bin] = h > 0 ? h / n : 0;
+	} else if (st->bin)
+		st->bins[st->bin] = st->bins[st->bin - 1];
+	st->bin_full = st->bin_partial = st->bin_partial_n = st->bin_sum = 0;
+	++st->bin;
+	st->bin_end = bin_end_pos(st, st->bin);
+}
+
+/* the window state is kept in locals, the byte stores would alias it */
+static void analyze(struct window *view, const uint8_t buf[], size_t count)
+{
+	struct entropy *st = view->priv;
+	unsigned win_size = st->win_size, win_fill = st->win_fill, win_pos = st->win_pos;
+	uint64_t win_sum = st->win_sum;
+	size_t i;
+
+	for (i = 0; i < count && st->bin < ENTROPY_BINS; ++i) {
+		unsigned in = buf[i];
+		unsigned c;
+
+		/* out first, a count never exceeds the window */
+		if (win_fill == win_size) {
+			unsigned out = st->window[win_pos];
+
+			c = st->counts[out]--;
+			win_sum -= clogc[c] - clogc[c - 1];
+		} else
+			++win_fill;
+		c = st->counts[in]++;
+		win_sum += clogc[c + 1] - clogc[c];
+		st->window[win_pos] = in;
+		if (++win_pos == win_size)
+			win_pos = 0;
+
+		if (win_fill == win_size) {
+			st->bin_full++;
+			st->bin_sum += win_sum;
+		} else {
+			st->bin_partial_n++;
+			st->bin_partial += (int64_t)log2n[win_fill] - win_sum / win_fill;
+		}
+		for (++st->blk_pos; st->blk_pos >= st->bin_end && st->bin < ENTROPY_BINS;)
+			end_bin(st);
+	}
+	st->win_fill = win_fill;
+	st->win_pos = win_pos;
+	st->win_sum = win_sum;
+}
+
+/* the bins do not depend on the graph size */
+static int redraw(struct window *view)
+{
+	return 1;
+}
+
+/* every column shows the mean of the complete bins it covers */
+static void render(struct window *view)
+{
+	const struct entropy *st = view->priv;
+	struct framebuffer *fb = &view->fb;
+	unsigned width = view->graph_area.width, height = view->graph_area.height;
+	unsigned x, y, i;
+
+	fb_fill(view, 0, 0, width, height, GRAPH_BG);
+	for (x = 0; x < width && x < fb->width; ++x) {
+		unsigned first = (uint64_t)x * ENTROPY_BINS / width;
+		unsigned last = (uint64_t)(x + 1) * ENTROPY_BINS / width;
+		uint64_t sum = 0;
+		uint32_t h;
+		unsigned bar;
+		uint8_t clr;
+
+		if (last <= first)
+			last = first + 1;
+		if (last > st->bin)
+			break;
+		for (i = first; i < last; ++i)
+			sum += st->bins[i];
+		h = sum / (last - first);
+		if (h > ENTROPY_MAX)
+			h = ENTROPY_MAX;
+		bar = (uint64_t)h * height / ENTROPY_MAX;
+		clr = GRAPH_FG((uint64_t)h * GRAPH_FG_COLORS / (ENTROPY_MAX + 1));
+		for (y = height - bar; y < height && y < fb->height; ++y)
+			fb_row(fb, y)[x] = clr;
+	}
+	fb_dirty(fb, 0, fb->height);
+}
+
+struct graph_desc entropy_graph = {
+	.name = "entropy",
+	.width = 512,
+	.height = 256,
+	.setup = setup,
+	.start_block = start_block,
+	.analyze = analyze,
+	.render = render,
+	.redraw = redraw,
+	.destroy = destroy,
+};
@@ -0,0 +1,267 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include "utils.h"
+#include "rawview.h"
+
+const struct graph_rgb graph_rgb[GRAPH_COLORS] = {
+	[GRAPH_BG]    = { 0,      0,      0 },
+	[GRAPH_FG(0)] = { 0x7fff, 0x7fff, 0x7fff },
+	[GRAPH_FG(1)] = { 0x82ff, 0x00ff, 0x8eff },
+	[GRAPH_FG(2)] = { 0xeaff, 0x00ff, 0xffff },
+	[GRAPH_FG(3)] = { 0x10ff, 0x00ff, 0xa9ff },
+	[GRAPH_FG(4)] = { 0x18ff, 0x00ff, 0xffff },
+	[GRAPH_FG(5)] = { 0x00ff, 0xe4ff, 0xffff },
+	[GRAPH_FG(6)] = { 0x00ff, 0xffff, 0x3cff },
+	[GRAPH_FG(7)] = { 0xeaff, 0xffff, 0x00ff },
+	[GRAPH_FG(8)] = { 0xffff, 0x84ff, 0x00ff },
+	[GRAPH_FG(9)] = { 0xffff, 0x00ff, 0x00ff },
+};
+
+static int host_lsb_first(void)
+{
+	const union { uint16_t v; uint8_t b[2]; } probe = { .v = 1 };
+
+	return probe.b[0];
+}
+
+/*
+ * Shared memory pixmaps let the graph pixmap live in our address space, so
+ * frames are never serialized over the X socket. Remote servers fail the
+ * attach in fb_create() and fall back to PutImage from then on.
+ */
+void fb_probe_shm(struct window *view)
+{
+	const xcb_query_extension_reply_t *ext = xcb_get_extension_data(view->c, &xcb_shm_id);
+	xcb_shm_query_version_reply_t *ver;
+
+	view->fb.shm_pixmaps = 0;
+	if (!ext || !ext->present)
+		return;
+	ver = xcb_shm_query_version_reply(view->c, xcb_shm_query_version(view->c), NULL);
+	if (ver && ver->shared_pixmaps && ver->pixmap_format == XCB_IMAGE_FORMAT_Z_PIXMAP)
+		view->fb.shm_pixmaps = 1;
+	trace("MIT-SHM %u.%u, shared pixmaps %s\n",
+	      ver ? ver->major_version : 0, ver ? ver->minor_version : 0,
+	      view->fb.shm_pixmaps ? "yes" : "no");
+	free(ver);
+}
+
+static int create_shm_image(struct window *view, size_t size)
+{
+	struct framebuffer *fb = &view->fb;
+	xcb_generic_error_t *err;
+	void *addr;
+	int id = shmget(IPC_PRIVATE, size, IPC_CREAT | 0600);
+
+	if (id == -1)
+		return -1;
+	addr = shmat(id, NULL, 0);
+	if (addr == (void *)-1) {
+		shmctl(id, IPC_RMID, NULL);
+		return -1;
+	}
+	fb->shmseg = xcb_generate_id(view->c);
+	err = xcb_request_check(view->c, xcb_shm_attach_checked(view->c, fb->shmseg, id, 0));
+	/* the segment goes away with the last detach */
+	shmctl(id, IPC_RMID, NULL);
+	if (err) {
+		free(err);
+		shmdt(addr);
+		return -1;
+	}
+	fb->image = addr;
+	return 0;
+}
+
+/*
+ * Allocate the client-side image for the current graph_area and the graph
+ * pixmap it is uploaded into.
+ */
+int fb_create(struct window *view)
+{
+	struct framebuffer *fb = &view->fb;
+	unsigned depth = 24, bpp = 32, pad = 32, i;
+	/* headless views convert for a core protocol 24 bit server */
+	size_t maxreq = UINT16_MAX * 4;
+
+	if (view->c) {
+		const xcb_setup_t *setup = xcb_get_setup(view->c);
+		xcb_screen_t *screen = xcb_setup_roots_iterator(setup).data;
+		xcb_format_iterator_t fmt;
+
+		depth = screen->root_depth;
+		for (fmt = xcb_setup_pixmap_formats_iterator(setup); fmt.rem; xcb_format_next(&fmt))
+			if (fmt.data->depth == depth) {
+				bpp = fmt.data->bits_per_pixel;
+				pad = fmt.data->scanline_pad;
+				break;
+			}
+		maxreq = (size_t)xcb_get_maximum_request_length(view->c) * 4;
+	}
+	if (bpp % 8 || bpp > 32) {
+		error("unsupported pixmap format: depth %u, %u bpp", depth, bpp);
+		return -1;
+	}
+	fb->depth = depth;
+	fb->bytes_per_pixel = bpp / 8;
+	fb->width = view->graph_area.width;
+	fb->height = view->graph_area.height;
+	fb->stride = (fb->width * bpp + pad - 1) / pad * pad / 8;
+	fb->rows_per_request = (maxreq - sizeof(xcb_put_image_request_t)) / fb->stride;
+	if (!fb->rows_per_request)
+		fb->rows_per_request = 1;
+	fb->palette[GRAPH_BG] = view->colors.graph_bg;
+	for (i = 0; i < countof(view->colors.graph_fg); ++i)
+		fb->palette[GRAPH_FG(i)] = view->colors.graph_fg[i];
+
+	fb->pix = calloc(fb->height, fb->width);
+	if (!fb->pix)
+		return -1;
+	fb->dirty_top = 0;
+	fb->dirty_bottom = fb->height;
+
+	fb->shm = 0;
+	if (view->c && fb->shm_pixmaps) {
+		if (create_shm_image(view, (size_t)fb->stride * fb->height) == 0) {
+			fb->shm = 1;
+			xcb_shm_create_pixmap(view->c, view->graph_pid, view->w,
+					      fb->width, fb->height, fb->depth,
+					      fb->shmseg, 0);
+			return 0;
+		}
+		trace("MIT-SHM attach failed, using PutImage\n");
+		fb->shm_pixmaps = 0;
+	}
+	fb->image = malloc((size_t)fb->stride * fb->height);
+	if (!fb->image) {
+		free(fb->pix);
+		fb->pix = NULL;
+		return -1;
+	}
+	if (view->c)
+		xcb_create_pixmap(view->c, fb->depth, view->graph_pid, view->w,
+				  fb->width, fb->height);
+	return 0;
+}
+
+void fb_destroy(struct window *view)
+{
+	struct framebuffer *fb = &view->fb;
+
+	if (view->c)
+		xcb_free_pixmap(view->c, view->graph_pid);
+	if (fb->shm) {
+		xcb_shm_detach(view->c, fb->shmseg);
+		shmdt(fb->image);
+	} else
+		free(fb->image);
+	free(fb->pix);
+	fb->pix = fb->image = NULL;
+	fb->width = fb->height = 0;
+	fb->dirty_top = fb->dirty_bottom = 0;
+}
+
+void fb_fill(struct window *view, int x, int y, unsigned w, unsigned h, uint8_t clr)
+{
+	struct framebuffer *fb = &view->fb;
+	long x1 = (long)x + w, y1 = (long)y + h;
+
+	if (x < 0)
+		x = 0;
+	if (y < 0)
+		y = 0;
+	if (x1 > fb->width)
+		x1 = fb->width;
+	if (y1 > fb->height)
+		y1 = fb->height;
+	if (x >= x1 || y >= y1)
+		return;
+	fb_dirty(fb, y, y1);
+	if (x == 0 && x1 == fb->width) {
+		memset(fb_row(fb, y), clr, (size_t)(y1 - y) * fb->width);
+		return;
+	}
+	for (; y < y1; ++y)
+		memset(fb_row(fb, y) + x, clr, x1 - x);
+}
+
+static void convert_rows(struct framebuffer *fb, unsigned top, unsigned bottom,
+			 int lsb_first)
+{
+	uint32_t enc[GRAPH_COLORS];
+	int swap = lsb_first != host_lsb_first();
+	unsigned i, x, y;
+
+	for (i = 0; i < GRAPH_COLORS; ++i) {
+		enc[i] = fb->palette[i];
+		if (swap && fb->bytes_per_pixel == 4)
+			enc[i] = __builtin_bswap32(enc[i]);
+		else if (swap && fb->bytes_per_pixel == 2)
+			enc[i] = __builtin_bswap16(enc[i]);
+	}
+	for (y = top; y < bottom; ++y) {
+		const uint8_t *src = fb_row(fb, y);
+		uint8_t *dst = fb->image + (size_t)y * fb->stride;
+
+		switch (fb->bytes_per_pixel) {
+		case 4:
+			for (x = 0; x < fb->width; ++x)
+				((uint32_t *)dst)[x] = enc[src[x]];
+			break;
+		case 2:
+			for (x = 0; x < fb->width; ++x)
+				((uint16_t *)dst)[x] = enc[src[x]];
+			break;
+		case 1:
+			for (x = 0; x < fb->width; ++x)
+				dst[x] = enc[src[x]];
+			break;
+		case 3:
+			for (x = 0; x < fb->width; ++x, dst += 3) {
+				uint32_t v = enc[src[x]];
+
+				dst[lsb_first ? 0 : 2] = v;
+				dst[1] = v >> 8;
+				dst[lsb_first ? 2 : 0] = v >> 16;
+			}
+			break;
+		}
+	}
+}
+
+/*
+ * Upload the dirty rows, in as few PutImage requests as the server allows.
+ * Headless views only convert and count the requests.
+ */
+void fb_flush(struct window *view)
+{
+	struct framebuffer *fb = &view->fb;
+	int lsb_first = host_lsb_first();
+	unsigned y, n;
+
+	if (fb->dirty_top >= fb->dirty_bottom)
+		return;
+	if (view->c)
+		lsb_first = xcb_get_setup(view->c)->image_byte_order == XCB_IMAGE_ORDER_LSB_FIRST;
+	convert_rows(fb, fb->dirty_top, fb->dirty_bottom, lsb_first);
+	/* the server reads a shared pixmap straight from the segment */
+	if (fb->shm) {
+		fb->dirty_top = fb->dirty_bottom = 0;
+		return;
+	}
+	for (y = fb->dirty_top; y < fb->dirty_bottom; y += n) {
+		n = fb->dirty_bottom - y;
+		if (n > fb->rows_per_request)
+			n = fb->rows_per_request;
+		if (view->c)
+			xcb_put_image(view->c, XCB_IMAGE_FORMAT_Z_PIXMAP,
+				      view->graph_pid, view->graph,
+				      fb->width, n, 0, y, 0, fb->depth,
+				      n * fb->stride, fb->image + (size_t)y * fb->stride);
+		fb->requests++;
+	}
+	fb->dirty_top = fb->dirty_bottom = 0;
+}
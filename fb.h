@@ -0,0 +1,78 @@
+#ifndef _FB_H_
+#define _FB_H_ 1
+
+#include <stdint.h>
+#include <string.h>
+#include <xcb/xcb.h>
+#include <xcb/shm.h>
+
+/* palette indices of the graph colors */
+#define GRAPH_BG (0)
+#define GRAPH_FG(n) (1 + (n))
+#define GRAPH_FG_COLORS (10)
+#define GRAPH_COLORS (1 + GRAPH_FG_COLORS)
+
+struct window;
+
+struct graph_rgb
+{
+	uint16_t r, g, b;
+};
+extern const struct graph_rgb graph_rgb[GRAPH_COLORS];
+
+/*
+ * Client-side image of the graph area. The graphs draw palette indices into
+ * pix, fb_flush() converts the dirty rows to pixels and uploads them into
+ * the graph pixmap.
+ */
+struct framebuffer
+{
+	uint8_t *pix;
+	unsigned width, height;
+	/* rows [dirty_top, dirty_bottom) changed since the last flush */
+	unsigned dirty_top, dirty_bottom;
+	uint32_t palette[GRAPH_COLORS];
+
+	/* converted pixels in the server format */
+	uint8_t *image;
+	unsigned depth;
+	unsigned bytes_per_pixel;
+	unsigned stride;
+	unsigned rows_per_request;
+	unsigned long requests;
+
+	/* MIT-SHM: image is a shared segment backing the graph pixmap */
+	unsigned shm_pixmaps:1;
+	unsigned shm:1;
+	xcb_shm_seg_t shmseg;
+};
+
+void fb_probe_shm(struct window *);
+int fb_create(struct window *);
+void fb_destroy(struct window *);
+void fb_fill(struct window *, int x, int y, unsigned w, unsigned h, uint8_t clr);
+void fb_flush(struct window *);
+
+static inline void fb_dirty(struct framebuffer *fb, unsigned top, unsigned bottom)
+{
+	if (bottom > fb->height)
+		bottom = fb->height;
+	if (top >= bottom)
+		return;
+	if (fb->dirty_top >= fb->dirty_bottom) {
+		fb->dirty_top = top;
+		fb->dirty_bottom = bottom;
+		return;
+	}
+	if (top < fb->dirty_top)
+		fb->dirty_top = top;
+	if (bottom > fb->dirty_bottom)
+		fb->dirty_bottom = bottom;
+}
+
+static inline uint8_t *fb_row(struct framebuffer *fb, unsigned y)
+{
+	return fb->pix + (size_t)y * fb->width;
+}
+
+#endif /* _FB_H_ */
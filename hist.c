@@ -0,0 +1,258 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+/* the AVX2 merge is built for any x86, it runs where the CPU has it */
+#if defined(__x86_64__) || defined(__i386__)
+#define HIST_AVX2 1
+#include <immintrin.h>
+#endif
+#include "hist.h"
+#include "pool.h"
+
+/*
+ * Counting into a single table makes runs of the same pair (zero fill,
+ * padding) a chain of dependent increments of one counter. Large buffers
+ * are spread round-robin over LANES private tables which are merged into
+ * the caller's at the end. A lane cannot wrap, the pairs of one call are
+ * at most LANES_MAX; hist saturates, as bigram_sat() does.
+ */
+#define LANES (4)
+#define LANES_MAX ((size_t)UINT32_MAX)
+
+static void count_scalar(uint32_t hist[BIGRAMS], const uint8_t buf[], size_t count)
+{
+	size_t i;
+
+	for (i = 1; i < count; ++i) {
+		uint32_t *c = &hist[BIGRAM(buf[i - 1], buf[i])];
+
+		*c += *c != UINT32_MAX;
+	}
+}
+
+static void count_lanes(uint32_t (*lane)[BIGRAMS], const uint8_t buf[], size_t count)
+{
+	uint32_t *l0 = lane[0], *l1 = lane[1], *l2 = lane[2], *l3 = lane[3];
+	size_t i = 1;
+#ifdef __SSE2__
+	uint16_t idx[16] __attribute__((aligned(16)));
+	unsigned k;
+
+	/* interleaving buf[i..] with buf[i - 1..] gives 16 pair indices at once */
+	for (; i + 16 <= count; i += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(buf + i - 1));
+		__m128i b = _mm_loadu_si128((const __m128i *)(buf + i));
+
+		_mm_store_si128((__m128i *)idx, _mm_unpacklo_epi8(b, a));
+		_mm_store_si128((__m128i *)idx + 1, _mm_unpackhi_epi8(b, a));
+		for (k = 0; k < 16; k += 4) {
+			l0[idx[k]]++;
+			l1[idx[k + 1]]++;
+			l2[idx[k + 2]]++;
+			l3[idx[k + 3]]++;
+		}
+	}
+#endif
+	for (; i + 4 <= count; i += 4) {
+		l0[BIGRAM(buf[i - 1], buf[i])]++;
+		l1[BIGRAM(buf[i], buf[i + 1])]++;
+		l2[BIGRAM(buf[i + 1], buf[i + 2])]++;
+		l3[BIGRAM(buf[i + 2], buf[i + 3])]++;
+	}
+	for (; i < count; ++i)
+		l0[BIGRAM(buf[i - 1], buf[i])]++;
+}
+
+/* unsigned a + b, all ones where it wrapped */
+#ifdef HIST_AVX2
+__attribute__((target("avx2")))
+static inline __m256i sat_add_avx2(__m256i a, __m256i b)
+{
+	const __m256i bias = _mm256_set1_epi32(INT32_MIN);
+	__m256i s = _mm256_add_epi32(a, b);
+
+	return _mm256_or_si256(s, _mm256_cmpgt_epi32(_mm256_xor_si256(a, bias),
+						     _mm256_xor_si256(s, bias)));
+}
+
+__attribute__((target("avx2")))
+static void merge_avx2(uint32_t hist[BIGRAMS], uint32_t (*lane)[BIGRAMS])
+{
+	const __m256i zero = _mm256_setzero_si256();
+	size_t i;
+	unsigned l;
+
+	for (i = 0; i < BIGRAMS; i += 8) {
+		__m256i s = _mm256_load_si256((const __m256i *)(lane[0] + i));
+
+		_mm256_store_si256((__m256i *)(lane[0] + i), zero);
+		for (l = 1; l < LANES; ++l) {
+			s = _mm256_add_epi32(s, _mm256_load_si256((const __m256i *)(lane[l] + i)));
+			_mm256_store_si256((__m256i *)(lane[l] + i), zero);
+		}
+		s = sat_add_avx2(_mm256_loadu_si256((const __m256i *)(hist + i)), s);
+		_mm256_storeu_si256((__m256i *)(hist + i), s);
+	}
+}
+#endif
+
+#ifdef __SSE2__
+static inline __m128i sat_add_sse2(__m128i a, __m128i b)
+{
+	const __m128i bias = _mm_set1_epi32(INT32_MIN);
+	__m128i s = _mm_add_epi32(a, b);
+
+	return _mm_or_si128(s, _mm_cmpgt_epi32(_mm_xor_si128(a, bias),
+					       _mm_xor_si128(s, bias)));
+}
+#endif
+
+/* add the lanes to hist and clear them for the next call */
+static void merge_lanes(uint32_t hist[BIGRAMS], uint32_t (*lane)[BIGRAMS])
+{
+	size_t i = 0;
+	unsigned l;
+#ifdef HIST_AVX2
+	if (__builtin_cpu_supports("avx2")) {
+		merge_avx2(hist, lane);
+		return;
+	}
+#endif
+#ifdef __SSE2__
+	const __m128i zero = _mm_setzero_si128();
+
+	for (; i < BIGRAMS; i += 4) {
+		__m128i s = _mm_load_si128((const __m128i *)(lane[0] + i));
+
+		_mm_store_si128((__m128i *)(lane[0] + i), zero);
+		for (l = 1; l < LANES; ++l) {
+			s = _mm_add_epi32(s, _mm_load_si128((const __m128i *)(lane[l] + i)));
+			_mm_store_si128((__m128i *)(lane[l] + i), zero);
+		}
+		s = sat_add_sse2(_mm_loadu_si128((const __m128i *)(hist + i)), s);
+		_mm_storeu_si128((__m128i *)(hist + i), s);
+	}
+#endif
+	for (; i < BIGRAMS; ++i) {
+		uint32_t sum = 0;
+
+		for (l = 0; l < LANES; ++l) {
+			sum += lane[l][i];
+			lane[l][i] = 0;
+		}
+		hist[i] = bigram_sat(hist[i], sum);
+	}
+}
+
+/*
+ * Add the counts of the byte pairs in buf to hist. The pair spanning two
+ * consecutive buffers is the caller's business.
+ */
+void bigram_count(uint32_t hist[BIGRAMS], const uint8_t buf[], size_t count)
+{
+	static __thread uint32_t (*lane)[BIGRAMS];
+	size_t len;
+
+	if (count >= BIGRAM_LANES_MIN && !lane) {
+		lane = aligned_alloc(64, sizeof(*lane) * LANES);
+		if (lane)
+			memset(lane, 0, sizeof(*lane) * LANES);
+	}
+	if (count < BIGRAM_LANES_MIN || !lane) {
+		count_scalar(hist, buf, count);
+		return;
+	}
+	/* pieces overlap by a byte, so that the pair between them is counted */
+	for (; count > 1; buf += len - 1, count -= len - 1) {
+		len = count < LANES_MAX ? count : LANES_MAX;
+		count_lanes(lane, buf, len);
+		merge_lanes(hist, lane);
+	}
+}
+
+/* hist += add, saturating */
+void bigram_add(uint32_t hist[BIGRAMS], const uint32_t add[BIGRAMS])
+{
+	unsigned i;
+
+	for (i = 0; i < BIGRAMS; ++i)
+		hist[i] = bigram_sat(hist[i], add[i]);
+}
+
+struct count_job
+{
+	uint32_t *hist;
+	uint32_t (*part)[BIGRAMS];
+	const uint8_t *buf;
+	size_t count, part_size;
+	unsigned nparts;
+};
+
+/* the first part is counted into hist, the others into their own table */
+static void count_part(void *arg, unsigned i)
+{
+	struct count_job *job = arg;
+	size_t off = i * job->part_size;
+	size_t n = i == job->nparts - 1 ? job->count - off : job->part_size;
+
+	bigram_count(i ? job->part[i - 1] : job->hist, job->buf + off, n);
+}
+
+/* add a slice of the part tables to hist and clear it */
+static void merge_part(void *arg, unsigned i)
+{
+	struct count_job *job = arg;
+	unsigned lo = BIGRAMS / job->nparts * i;
+	unsigned hi = i == job->nparts - 1 ? BIGRAMS : lo + BIGRAMS / job->nparts;
+	unsigned p, k;
+
+	for (p = 0; p < job->nparts - 1; ++p)
+		for (k = lo; k < hi; ++k) {
+			job->hist[k] = bigram_sat(job->hist[k], job->part[p][k]);
+			job->part[p][k] = 0;
+		}
+}
+
+/*
+ * bigram_count() with buf split over the threads of the pool. The parts
+ * are counted into tables of their own, summed up into hist slice by slice
+ * and the pairs spanning two parts added at last.
+ */
+void bigram_count_pool(struct pool *pool, uint32_t hist[BIGRAMS],
+		       const uint8_t buf[], size_t count)
+{
+	static __thread uint32_t (*part)[BIGRAMS];
+	static __thread unsigned nalloc;
+	struct count_job job = { .hist = hist, .buf = buf, .count = count };
+	unsigned i, n = pool_threads(pool);
+
+	if (n > count / BIGRAM_PART_MIN)
+		n = count / BIGRAM_PART_MIN;
+	if (n > nalloc + 1) {
+		uint32_t (*p)[BIGRAMS] = calloc(n - 1, sizeof(*p));
+
+		if (p) {
+			free(part);
+			part = p;
+			nalloc = n - 1;
+		} else
+			n = nalloc + 1;
+	}
+	if (n < 2) {
+		bigram_count(hist, buf, count);
+		return;
+	}
+	job.part = part;
+	job.nparts = n;
+	job.part_size = count / n;
+	pool_run(pool, n, count_part, &job);
+	pool_run(pool, n, merge_part, &job);
+	for (i = 1; i < n; ++i) {
+		uint32_t *c = &hist[BIGRAM(buf[i * job.part_size - 1], buf[i * job.part_size])];
+
+		*c = bigram_sat(*c, 1);
+	}
+}
@@ -0,0 +1,30 @@
+#ifndef _HIST_H_
+#define _HIST_H_ 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BIGRAMS (256 * 256)
+#define BIGRAM(a, b) ((unsigned)(a) << 8 | (b))
+
+/* buffers at least this large are counted into private sub-tables */
+#define BIGRAM_LANES_MIN (256 * 1024)
+/* pieces of a buffer counted on a worker pool are at least this large */
+#define BIGRAM_PART_MIN (1024 * 1024)
+
+struct pool;
+
+/* the counts stick at UINT32_MAX instead of wrapping, the graphs show "many" */
+static inline uint32_t bigram_sat(uint32_t a, uint32_t b)
+{
+	uint32_t s = a + b;
+
+	return s < a ? UINT32_MAX : s;
+}
+
+void bigram_count(uint32_t hist[BIGRAMS], const uint8_t buf[], size_t count);
+void bigram_add(uint32_t hist[BIGRAMS], const uint32_t add[BIGRAMS]);
+void bigram_count_pool(struct pool *, uint32_t hist[BIGRAMS],
+		       const uint8_t buf[], size_t count);
+
+#endif /* _HIST_H_ */
@@ -0,0 +1,164 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "utils.h"
+#include "image.h"
+
+int write_ppm(const struct framebuffer *fb, FILE *fp)
+{
+	unsigned x, y;
+
+	fprintf(fp, "P6\n%u %u\n255\n", fb->width, fb->height);
+	for (y = 0; y < fb->height; ++y) {
+		const uint8_t *src = fb_row((struct framebuffer *)fb, y);
+
+		for (x = 0; x < fb->width; ++x) {
+			const struct graph_rgb *c = graph_rgb + src[x];
+
+			putc(c->r >> 8, fp);
+			putc(c->g >> 8, fp);
+			putc(c->b >> 8, fp);
+		}
+	}
+	return fflush(fp) == EOF || ferror(fp) ? -1 : 0;
+}
+
+/*
+ * PNG output, palette indices as they are, with the image data in stored
+ * (uncompressed) deflate blocks so that no zlib is needed.
+ */
+struct png_chunk
+{
+	FILE *fp;
+	uint32_t crc;
+};
+
+static uint32_t crc_table[256];
+
+static void make_crc_table(void)
+{
+	uint32_t c;
+	unsigned n, k;
+
+	for (n = 0; n < 256; ++n) {
+		c = n;
+		for (k = 0; k < 8; ++k)
+			c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+		crc_table[n] = c;
+	}
+}
+
+static void put_be32(FILE *fp, uint32_t v)
+{
+	putc(v >> 24, fp);
+	putc(v >> 16, fp);
+	putc(v >> 8, fp);
+	putc(v, fp);
+}
+
+static void chunk_write(struct png_chunk *ch, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+	size_t i;
+
+	for (i = 0; i < len; ++i)
+		ch->crc = crc_table[(ch->crc ^ p[i]) & 0xff] ^ (ch->crc >> 8);
+	fwrite(data, 1, len, ch->fp);
+}
+
+static void chunk_begin(struct png_chunk *ch, const char *type, uint32_t len)
+{
+	put_be32(ch->fp, len);
+	ch->crc = 0xffffffffu;
+	chunk_write(ch, type, 4);
+}
+
+static void chunk_end(struct png_chunk *ch)
+{
+	put_be32(ch->fp, ch->crc ^ 0xffffffffu);
+}
+
+static void chunk_be32(struct png_chunk *ch, uint32_t v)
+{
+	const uint8_t b[4] = { v >> 24, v >> 16, v >> 8, v };
+
+	chunk_write(ch, b, sizeof(b));
+}
+
+#define STORED_MAX (65535)
+
+int write_png(const struct framebuffer *fb, FILE *fp)
+{
+	static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	struct png_chunk ch = { .fp = fp };
+	size_t raw = (size_t)fb->height * (fb->width + 1);
+	size_t blocks = raw / STORED_MAX + 1;
+	size_t left = raw, block = 0;
+	uint32_t a = 1, b = 0;
+	unsigned x = 0, y = 0, i;
+
+	if (!crc_table[1])
+		make_crc_table();
+	fwrite(signature, 1, sizeof(signature), fp);
+
+	chunk_begin(&ch, "IHDR", 13);
+	chunk_be32(&ch, fb->width);
+	chunk_be32(&ch, fb->height);
+	chunk_write(&ch, (const uint8_t []){ 8, 3, 0, 0, 0 }, 5);
+	chunk_end(&ch);
+
+	chunk_begin(&ch, "PLTE", 3 * GRAPH_COLORS);
+	for (i = 0; i < GRAPH_COLORS; ++i)
+		chunk_write(&ch, (const uint8_t []){
+				graph_rgb[i].r >> 8,
+				graph_rgb[i].g >> 8,
+				graph_rgb[i].b >> 8 }, 3);
+	chunk_end(&ch);
+
+	chunk_begin(&ch, "IDAT", 2 + 5 * blocks + raw + 4);
+	chunk_write(&ch, (const uint8_t []){ 0x78, 0x01 }, 2);
+	for (block = 0; block < blocks; ++block) {
+		size_t len = left < STORED_MAX ? left : STORED_MAX;
+		const uint8_t hdr[5] = {
+			block + 1 == blocks,
+			len, len >> 8, ~len, ~len >> 8,
+		};
+
+		chunk_write(&ch, hdr, sizeof(hdr));
+		left -= len;
+		while (len) {
+			const uint8_t *src;
+			size_t n;
+
+			if (x == 0) {
+				/* rows are prefixed with filter type 0 */
+				chunk_write(&ch, (const uint8_t []){ 0 }, 1);
+				b = (b + a) % 65521;
+				x = 1;
+				--len;
+				continue;
+			}
+			src = fb_row((struct framebuffer *)fb, y) + x - 1;
+			n = fb->width + 1 - x;
+			if (n > len)
+				n = len;
+			chunk_write(&ch, src, n);
+			for (i = 0; i < n; ++i) {
+				a = (a + src[i]) % 65521;
+				b = (b + a) % 65521;
+			}
+			x += n;
+			len -= n;
+			if (x == fb->width + 1) {
+				x = 0;
+				++y;
+			}
+		}
+	}
+	chunk_be32(&ch, b << 16 | a);
+	chunk_end(&ch);
+
+	chunk_begin(&ch, "IEND", 0);
+	chunk_end(&ch);
+	return fflush(fp) == EOF || ferror(fp) ? -1 : 0;
+}
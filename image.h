@@ -0,0 +1,10 @@
+#ifndef _IMAGE_H_
+#define _IMAGE_H_ 1
+
+#include <stdio.h>
+#include "fb.h"
+
+int write_ppm(const struct framebuffer *, FILE *);
+int write_png(const struct framebuffer *, FILE *);
+
+#endif /* _IMAGE_H_ */
@@ -0,0 +1,206 @@
+#define _GNU_SOURCE /* mremap */
+#include <stdint.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "rawview.h"
+#include "input.h"
+#include "uring.h"
+#include "spill.h"
+#include "stats.h"
+
+/*
+ * Map the input if it is a regular file. The graphs get pointers straight
+ * into the mapping, the read() path stays for pipes and everything else
+ * which cannot be mapped.
+ */
+int input_map(struct input *in)
+{
+	struct stat st;
+	void *map;
+
+	if (fstat(in->pfd.fd, &st) == -1)
+		return -1;
+	if (!S_ISREG(st.st_mode) || st.st_size == 0 ||
+	    (unsigned long long)st.st_size > SIZE_MAX)
+		return -1;
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, in->pfd.fd, 0);
+	if (map == MAP_FAILED) {
+		trace("%s: %s\n", __func__, strerror(errno));
+		return -1;
+	}
+	in->map = map;
+	in->map_size = st.st_size;
+	if (!in->map_chunk)
+		in->map_chunk = INPUT_MAP_CHUNK;
+	trace("%s: %lld bytes\n", __func__, (long long)in->map_size);
+	return 0;
+}
+
+/*
+ * Read a regular file on io_uring, with several reads in flight ahead of
+ * the graph, and with O_DIRECT past the page cache if asked to. Returns -1
+ * if the kernel cannot, the caller falls back to the mapping.
+ */
+int input_uring(struct input *in, int direct)
+{
+	struct stat st;
+
+	if (fstat(in->pfd.fd, &st) == -1 || !S_ISREG(st.st_mode))
+		return -1;
+	in->ring = uring_new(in->pfd.fd, direct);
+	return in->ring ? 0 : -1;
+}
+
+static void advise_block(struct input *in)
+{
+	long pgsz = sysconf(_SC_PAGESIZE);
+	off_t start = in->input_offset & ~(off_t)(pgsz - 1);
+	off_t end = in->input_offset + in->input_size;
+
+	if (start >= in->map_size)
+		return;
+	if (end > in->map_size)
+		end = in->map_size;
+	madvise((void *)(in->map + start), end - start, MADV_SEQUENTIAL);
+	madvise((void *)(in->map + start), end - start, MADV_WILLNEED);
+}
+
+void input_start_block(struct input *in)
+{
+	in->amount = 0;
+	if (in->map)
+		advise_block(in);
+	if (in->ring)
+		uring_start(in->ring, in->input_offset, in->input_offset + in->input_size);
+}
+
+/*
+ * Return the next piece of the current block in *data, at most count bytes.
+ * Mapped input is handed out in INPUT_MAP_CHUNK steps so that the poll loop
+ * stays responsive, io_uring reads in the buffers they were read into, a
+ * spilled pipe from its ring, everything else goes through buf.
+ */
+static ssize_t next_piece(struct input *in, const uint8_t **data, size_t count)
+{
+	ssize_t rd;
+
+	if (in->map) {
+		off_t pos = in->input_offset + in->amount;
+
+		if (pos >= in->map_size)
+			return 0;
+		if (count > in->map_chunk)
+			count = in->map_chunk;
+		if ((off_t)count > in->map_size - pos)
+			count = in->map_size - pos;
+		*data = in->map + pos;
+		in->amount += count;
+		return count;
+	}
+	if (in->spill) {
+		/* the ring is overwritten cap bytes on, the pieces in flight stay small */
+		if (count > INPUT_MAP_CHUNK)
+			count = INPUT_MAP_CHUNK;
+		rd = spill_read(in->spill, in->pfd.fd, in->input_offset + in->amount, data, count);
+		if (rd > 0)
+			in->amount += rd;
+		return rd;
+	}
+	if (in->ring) {
+		rd = uring_next(in->ring, in->input_offset + in->amount, data, count);
+		if (rd > 0)
+			in->amount += rd;
+		return rd;
+	}
+	rd = read(in->pfd.fd, in->buf, count < in->bufsize ? count : in->bufsize);
+	stats_add(STAT_READS, 1);
+	if (rd > 0)
+		in->amount += rd;
+	*data = in->buf;
+	return rd;
+}
+
+ssize_t input_next(struct input *in, const uint8_t **data, size_t count)
+{
+	ssize_t rd = next_piece(in, data, count);
+
+	if (rd > 0)
+		stats_add(STAT_READ_BYTES, rd);
+	return rd;
+}
+
+/*
+ * The file may have grown since the block ended short: the mapping grows
+ * with it and the ring reads the rest of the block again. Returns 1 if
+ * there is more to read.
+ */
+int input_grow(struct input *in)
+{
+	off_t pos = in->input_offset + in->amount;
+	struct stat st;
+
+	if (fstat(in->pfd.fd, &st) == -1 || !S_ISREG(st.st_mode))
+		return 0;
+	if (in->map && st.st_size > in->map_size) {
+		void *map = mremap((void *)in->map, in->map_size, st.st_size, MREMAP_MAYMOVE);
+
+		if (map == MAP_FAILED) {
+			trace("%s: %s\n", __func__, strerror(errno));
+			return 0;
+		}
+		in->map = map;
+		in->map_size = st.st_size;
+	}
+	if (in->ring)
+		uring_start(in->ring, pos, in->input_offset + in->input_size);
+	return st.st_size > pos;
+}
+
+/* where the input can be read from, a spilled pipe forgets its oldest data */
+off_t input_first(const struct input *in)
+{
+	return in->spill ? spill_first(in->spill) : 0;
+}
+
+static void prefetch(struct input *in, off_t off, off_t len)
+{
+	long pgsz = sysconf(_SC_PAGESIZE);
+	off_t start = off & ~(off_t)(pgsz - 1);
+
+	if (off < 0 || len <= 0)
+		return;
+	if (!in->map) {
+		/* read-ahead into the page cache, pipes just fail with ESPIPE */
+		posix_fadvise(in->pfd.fd, off, len, POSIX_FADV_WILLNEED);
+		return;
+	}
+	if (start >= in->map_size)
+		return;
+	if (off + len > in->map_size)
+		len = in->map_size - off;
+	madvise((void *)(in->map + start), off + len - start, MADV_WILLNEED);
+}
+
+/*
+ * Start reading the blocks after and before the current one in the
+ * background. The next block comes first, that is where autoscroll goes.
+ */
+void input_prefetch(struct input *in)
+{
+	off_t size = in->input_size;
+
+	/* the ring reads ahead itself, past the page cache with O_DIRECT */
+	if (in->ring) {
+		uring_ahead(in->ring, in->input_offset + size, in->input_offset + 2 * size);
+		return;
+	}
+	prefetch(in, in->input_offset + size, size);
+	if (in->input_offset > 0)
+		prefetch(in, in->input_offset > size ? in->input_offset - size : 0,
+			 in->input_offset > size ? size : in->input_offset);
+}
@@ -0,0 +1,38 @@
+#ifndef _INPUT_H_
+#define _INPUT_H_ 1
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "poll-fds.h"
+
+/* amount of mapped input handed to the graph per poll wakeup and thread */
+#define INPUT_MAP_CHUNK (1024 * 1024)
+
+struct input
+{
+	struct poll_fd pfd;
+	off_t input_offset;
+	size_t input_size;
+	size_t amount;
+	size_t bufsize;
+	/* read-only mapping of the whole input, if it is a regular file */
+	const uint8_t *map;
+	off_t map_size;
+	size_t map_chunk; /* INPUT_MAP_CHUNK unless set */
+	/* reads of a regular file on io_uring, instead of the mapping */
+	struct uring *ring;
+	/* a pipe kept for reading it again */
+	struct spill *spill;
+	uint8_t buf[BUFSIZ];
+};
+
+int input_map(struct input *);
+int input_uring(struct input *, int direct);
+void input_start_block(struct input *);
+ssize_t input_next(struct input *, const uint8_t **data, size_t count);
+void input_prefetch(struct input *);
+int input_grow(struct input *);
+off_t input_first(const struct input *);
+
+#endif /* _INPUT_H_ */
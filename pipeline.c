@@ -0,0 +1,371 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include "rawview.h"
+#include "input.h"
+#include "pipeline.h"
+#include "spans.h"
+
+/* how long a reader waits on a pipe before it looks into the spill again */
+#define PIPELINE_WAIT_MS (20)
+
+struct chunk
+{
+	const uint8_t *data;
+	size_t len;
+	off_t pos; /* of data in the input */
+	int end; /* 1: the block is complete, -1: the input ended, with err */
+	int err;
+};
+
+struct pipeline
+{
+	struct input *in;
+	void (*analyze)(void *, const uint8_t [], size_t);
+	void *arg;
+	pthread_t reader, analyzer;
+	pthread_mutex_t graphs;
+
+	/* the threads run the block while their flag is set, under lock */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	unsigned reading:1, analyzing:1;
+	unsigned quit:1; /* the threads return, pipeline_new() failed */
+	int cancel;
+
+	/* reader to analyzer: the analyzer takes at head, the reader puts at tail */
+	struct chunk ring[PIPELINE_SLOTS];
+	uint8_t *buf[PIPELINE_SLOTS];
+	unsigned head, tail;
+	int pushed, popped; /* eventfds the other side waits on */
+
+	/* analyzer to event loop */
+	size_t amount;
+	int state, err;
+	int progress;
+};
+
+static void signal_fd(int fd)
+{
+	uint64_t one = 1;
+
+	write(fd, &one, sizeof(one));
+}
+
+static void wait_fd(int fd)
+{
+	uint64_t n;
+
+	read(fd, &n, sizeof(n));
+}
+
+static int cancelled(struct pipeline *p)
+{
+	return __atomic_load_n(&p->cancel, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * A pipe is polled together with the eventfd stop() signals, so that a
+ * reader waiting for input can be cancelled. Returns 0 if the input has
+ * nothing within ms, -1 when cancelled.
+ */
+static int wait_input(struct pipeline *p, int ms)
+{
+	struct pollfd fds[2] = {
+		{ .fd = p->in->pfd.fd, .events = POLLIN },
+		{ .fd = p->popped, .events = POLLIN },
+	};
+
+	for (;;) {
+		int n;
+
+		if (cancelled(p))
+			return -1;
+		n = poll(fds, 2, ms);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n == -1 || fds[0].revents)
+			return 1; /* read() tells */
+		if (!n)
+			return 0;
+		wait_fd(p->popped);
+	}
+}
+
+/*
+ * Mapped and spilled input is handed on as it is. Everything else is
+ * copied out of the buffer input_next() reused, as much as there is
+ * without waiting for more.
+ */
+static ssize_t fill_chunk(struct pipeline *p, struct chunk *c, uint8_t *buf)
+{
+	struct input *in = p->in;
+	const uint8_t *data;
+	ssize_t rd;
+
+	c->len = 0;
+	c->pos = in->input_offset + in->amount;
+	while (in->map || in->spill) {
+		rd = input_next(in, &c->data, in->input_size - in->amount);
+		/* a pipe another view reads shows up in the spill */
+		if (rd == -1 && errno == EAGAIN) {
+			if (wait_input(p, PIPELINE_WAIT_MS) == -1) {
+				errno = ECANCELED;
+				return -1;
+			}
+			continue;
+		}
+		if (rd > 0)
+			c->len = rd;
+		return rd;
+	}
+	c->data = buf;
+	while (c->len < PIPELINE_CHUNK && in->amount < in->input_size) {
+		size_t count = PIPELINE_CHUNK - c->len;
+
+		if (!in->ring) {
+			int ready = wait_input(p, c->len ? 0 : -1);
+
+			if (ready == -1) {
+				errno = ECANCELED;
+				return -1;
+			}
+			if (!ready)
+				break;
+		}
+		if (count > in->input_size - in->amount)
+			count = in->input_size - in->amount;
+		rd = input_next(in, &data, count);
+		if (rd == -1 && errno == EINTR)
+			continue;
+		if (rd <= 0)
+			return c->len ? (ssize_t)c->len : rd;
+		memcpy(buf + c->len, data, rd);
+		c->len += rd;
+	}
+	return c->len;
+}
+
+static void read_block(struct pipeline *p)
+{
+	struct input *in = p->in;
+	unsigned tail = p->tail;
+
+	for (;;) {
+		struct chunk *c = &p->ring[tail % PIPELINE_SLOTS];
+		uint64_t span;
+		ssize_t rd;
+
+		/* backpressure: a slow analyzer holds the reader back */
+		while (tail - __atomic_load_n(&p->head, __ATOMIC_ACQUIRE) == PIPELINE_SLOTS) {
+			if (cancelled(p))
+				return;
+			wait_fd(p->popped);
+		}
+		if (cancelled(p))
+			return;
+		span = span_begin();
+		rd = fill_chunk(p, c, p->buf[tail % PIPELINE_SLOTS]);
+		span_end(__func__, span, "\"bytes\":%zd", rd);
+		if (rd == -1 && errno == ECANCELED)
+			return;
+		c->end = in->amount >= in->input_size ? 1 : rd <= 0 ? -1 : 0;
+		c->err = rd < 0 ? errno : 0;
+		__atomic_store_n(&p->tail, ++tail, __ATOMIC_RELEASE);
+		signal_fd(p->pushed);
+		if (c->end)
+			return;
+	}
+}
+
+static void analyze_block(struct pipeline *p)
+{
+	unsigned head = p->head;
+
+	for (;;) {
+		const struct chunk *c = &p->ring[head % PIPELINE_SLOTS];
+		size_t len;
+		int end, err;
+
+		while (__atomic_load_n(&p->tail, __ATOMIC_ACQUIRE) == head) {
+			if (cancelled(p))
+				return;
+			wait_fd(p->pushed);
+		}
+		if (cancelled(p))
+			return;
+		len = c->len;
+		end = c->end;
+		err = c->err;
+		if (len) {
+			pthread_mutex_lock(&p->graphs);
+			p->analyze(p->arg, c->data, len);
+			pthread_mutex_unlock(&p->graphs);
+			/* another view's reader may have refilled the spill under it */
+			if (input_first(p->in) > c->pos) {
+				end = -1;
+				err = ESPIPE;
+			}
+		}
+		/* the slot is the reader's again */
+		__atomic_store_n(&p->head, ++head, __ATOMIC_RELEASE);
+		signal_fd(p->popped);
+		__atomic_store_n(&p->amount, p->amount + len, __ATOMIC_RELEASE);
+		if (end) {
+			p->err = err;
+			__atomic_store_n(&p->state, end, __ATOMIC_RELEASE);
+		}
+		signal_fd(p->progress);
+		if (end)
+			return;
+	}
+}
+
+static void run_stage(struct pipeline *p, unsigned flag, void (*stage)(struct pipeline *))
+{
+	pthread_mutex_lock(&p->lock);
+	for (;;) {
+		while (!(flag ? p->reading : p->analyzing) && !p->quit)
+			pthread_cond_wait(&p->cond, &p->lock);
+		if (p->quit)
+			break;
+		pthread_mutex_unlock(&p->lock);
+		stage(p);
+		pthread_mutex_lock(&p->lock);
+		if (flag)
+			p->reading = 0;
+		else
+			p->analyzing = 0;
+		pthread_cond_broadcast(&p->cond);
+	}
+	pthread_mutex_unlock(&p->lock);
+}
+
+static void *reader_main(void *arg)
+{
+	run_stage(arg, 1, read_block);
+	return NULL;
+}
+
+static void *analyzer_main(void *arg)
+{
+	run_stage(arg, 0, analyze_block);
+	return NULL;
+}
+
+struct pipeline *pipeline_new(struct input *in,
+			      void (*analyze)(void *, const uint8_t [], size_t),
+			      void *arg)
+{
+	struct pipeline *p = calloc(1, sizeof(*p));
+	unsigned i;
+	int ret;
+
+	if (!p)
+		return NULL;
+	p->in = in;
+	p->analyze = analyze;
+	p->arg = arg;
+	p->pushed = p->popped = p->progress = -1;
+	for (i = 0; i < PIPELINE_SLOTS; ++i)
+		if (!in->map && !in->spill && !(p->buf[i] = malloc(PIPELINE_CHUNK)))
+			goto fail;
+	p->pushed = eventfd(0, EFD_CLOEXEC);
+	p->popped = eventfd(0, EFD_CLOEXEC);
+	p->progress = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (p->pushed == -1 || p->popped == -1 || p->progress == -1)
+		goto fail;
+	pthread_mutex_init(&p->graphs, NULL);
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->cond, NULL);
+	ret = pthread_create(&p->reader, NULL, reader_main, p);
+	if (ret)
+		goto fail_thread;
+	ret = pthread_create(&p->analyzer, NULL, analyzer_main, p);
+	if (ret) {
+		/* the reader is idle, it only waits for the quit */
+		pthread_mutex_lock(&p->lock);
+		p->quit = 1;
+		pthread_cond_broadcast(&p->cond);
+		pthread_mutex_unlock(&p->lock);
+		pthread_join(p->reader, NULL);
+		goto fail_thread;
+	}
+	return p;
+fail_thread:
+	errno = ret;
+	pthread_cond_destroy(&p->cond);
+	pthread_mutex_destroy(&p->lock);
+	pthread_mutex_destroy(&p->graphs);
+fail:
+	trace("%s: %s\n", __func__, strerror(errno));
+	close(p->pushed);
+	close(p->popped);
+	close(p->progress);
+	for (i = 0; i < PIPELINE_SLOTS; ++i)
+		free(p->buf[i]);
+	free(p);
+	return NULL;
+}
+
+int pipeline_fd(const struct pipeline *p)
+{
+	return p->progress;
+}
+
+void pipeline_start(struct pipeline *p)
+{
+	pthread_mutex_lock(&p->lock);
+	if (!p->reading && !p->analyzing) {
+		p->amount = p->in->amount;
+		p->state = 0;
+		p->err = 0;
+		p->reading = 1;
+		p->analyzing = 1;
+		pthread_cond_broadcast(&p->cond);
+	}
+	pthread_mutex_unlock(&p->lock);
+}
+
+void pipeline_stop(struct pipeline *p)
+{
+	pthread_mutex_lock(&p->lock);
+	if (p->reading || p->analyzing) {
+		__atomic_store_n(&p->cancel, 1, __ATOMIC_RELEASE);
+		signal_fd(p->pushed);
+		signal_fd(p->popped);
+		while (p->reading || p->analyzing)
+			pthread_cond_wait(&p->cond, &p->lock);
+	}
+	/* what is left in the ring belonged to the block */
+	p->head = p->tail = 0;
+	p->cancel = 0;
+	pthread_mutex_unlock(&p->lock);
+}
+
+int pipeline_progress(struct pipeline *p, size_t *amount)
+{
+	int state;
+
+	wait_fd(p->progress);
+	state = __atomic_load_n(&p->state, __ATOMIC_ACQUIRE);
+	*amount = __atomic_load_n(&p->amount, __ATOMIC_ACQUIRE);
+	if (state < 0)
+		errno = p->err;
+	return state;
+}
+
+void pipeline_lock(struct pipeline *p)
+{
+	pthread_mutex_lock(&p->graphs);
+}
+
+void pipeline_unlock(struct pipeline *p)
+{
+	pthread_mutex_unlock(&p->graphs);
+}
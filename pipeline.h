@@ -0,0 +1,39 @@
+#ifndef _PIPELINE_H_
+#define _PIPELINE_H_ 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The block is read and analyzed on two threads of their own. The reader
+ * hands chunks of it to the analyzer over a lock-free single-producer,
+ * single-consumer ring of PIPELINE_SLOTS and waits while the ring is full;
+ * the analyzer publishes how far it got and signals an eventfd the event
+ * loop polls, which draws at its own pace.
+ */
+#define PIPELINE_SLOTS (8)
+/* what is not mapped is copied into chunks of at most this size */
+#define PIPELINE_CHUNK (256 * 1024)
+
+struct input;
+struct pipeline;
+
+struct pipeline *pipeline_new(struct input *,
+			      void (*analyze)(void *arg, const uint8_t buf[], size_t count),
+			      void *arg);
+/* readable when the analyzer got further */
+int pipeline_fd(const struct pipeline *);
+/* read and analyze the current block of the input, from its amount on */
+void pipeline_start(struct pipeline *);
+/* cancel the block, once it returns neither thread touches the input */
+void pipeline_stop(struct pipeline *);
+/*
+ * How much of the block is analyzed, between start and stop. Returns 1 once
+ * it is complete, -1 with errno (0 at end of input) if it cannot be, else 0.
+ */
+int pipeline_progress(struct pipeline *, size_t *amount);
+/* held around analyze(), whoever else looks at what it analyzes takes it too */
+void pipeline_lock(struct pipeline *);
+void pipeline_unlock(struct pipeline *);
+
+#endif /* _PIPELINE_H_ */
@@ -5,60 +5,165 @@
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 #include "poll-fds.h"
 
+/* events dispatched per epoll_wait() */
+#define POLL_BATCH (64)
+
+/* the POLL* and EPOLL* bits have the same values on Linux */
+
+static void init_context(struct poll_context *ctx)
+{
+	ctx->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (ctx->epfd == -1)
+		abort();
+	ctx->initialized = 1;
+}
+
+static void link_ready(struct poll_context *ctx, struct poll_fd *pfd)
+{
+	pfd->prev = NULL;
+	pfd->next = ctx->ready;
+	if (ctx->ready)
+		ctx->ready->prev = pfd;
+	ctx->ready = pfd;
+}
+
+static void unlink_ready(struct poll_context *ctx, struct poll_fd *pfd)
+{
+	if (pfd->prev)
+		pfd->prev->next = pfd->next;
+	else
+		ctx->ready = pfd->next;
+	if (pfd->next)
+		pfd->next->prev = pfd->prev;
+}
+
 void add_poll(struct poll_context *ctx, struct poll_fd *pfd)
 {
-	unsigned i;
+	struct epoll_event ev = {
+		.events = pfd->events | (pfd->edge ? EPOLLET : 0),
+		.data.ptr = pfd,
+	};
 
-	for (i = 0; i < ctx->npolls; ++i)
-		if (ctx->polls[i] == pfd)
-			return;
-	if (ctx->npolls >= MAX_POLL_ELEMENTS) {
-		abort();
+	if (!ctx->initialized)
+		init_context(ctx);
+	if (pfd->polled)
 		return;
+	pfd->always_ready = 0;
+	if (epoll_ctl(ctx->epfd, EPOLL_CTL_ADD, pfd->fd, &ev) == -1) {
+		/* EEXIST: an owner closed its fd before remove_poll() */
+		if (errno != EPERM)
+			abort();
+		pfd->always_ready = 1;
+		link_ready(ctx, pfd);
 	}
-	ctx->polls[ctx->npolls++] = pfd;
+	pfd->polled = 1;
+	ctx->npolls++;
 }
 
 void remove_poll(struct poll_context *ctx, struct poll_fd *pfd)
 {
-	unsigned i, o, nfds = ctx->npolls;
-
-	for (i = 0, o = 0; i < nfds; ++i) {
-		if (ctx->polls[i] == pfd) {
-			ctx->npolls--;
-			continue;
-		}
-		ctx->polls[o++] = ctx->polls[i];
-	}
+	unsigned i;
+
+	if (!pfd->polled)
+		return;
+	if (pfd->always_ready)
+		unlink_ready(ctx, pfd);
+	else
+		/*
+		 * Before the fd is closed: epoll keeps it registered while any
+		 * process still holds the file, a fork or a dup.
+		 */
+		epoll_ctl(ctx->epfd, EPOLL_CTL_DEL, pfd->fd, NULL);
+	pfd->polled = 0;
+	ctx->npolls--;
+	for (i = 0; i < ctx->npending; ++i)
+		if (ctx->pending[i] == pfd)
+			ctx->pending[i] = NULL;
+}
+
+static void dispatch(struct poll_context *ctx, struct poll_fd *pfd, short revents)
+{
+	pfd->revents = revents;
+	if (pfd->revents && pfd->proc)
+		pfd->proc(ctx, pfd);
+}
+
+/* the first n of pending get their events, remove_poll() clears any of watch */
+static void dispatch_pending(struct poll_context *ctx, struct poll_fd **pending,
+			     unsigned n, unsigned watch, const struct epoll_event *evs)
+{
+	unsigned i;
+
+	ctx->pending = pending;
+	ctx->npending = watch;
+	for (i = 0; i < n; ++i)
+		if (pending[i])
+			dispatch(ctx, pending[i], evs ? evs[i].events :
+				 pending[i]->events & (POLLIN|POLLOUT));
+	ctx->pending = NULL;
+	ctx->npending = 0;
 }
 
 int poll_fds(struct poll_context *ctx, int ms)
 {
+	struct epoll_event evs[POLL_BATCH];
+	struct poll_fd *pending[POLL_BATCH + 1];
+	struct poll_fd *pfd;
+	unsigned i, n;
 	int ret;
-	struct poll_fd **ppfd;
-	struct poll_fd *polls[MAX_POLL_ELEMENTS];
-	struct pollfd fds[MAX_POLL_ELEMENTS];
-	nfds_t nfds = ctx->npolls;
-	unsigned i;
 
-	ppfd = ctx->polls;
-	for (i = 0; i < nfds; ++i, ++ppfd) {
-		polls[i] = *ppfd;
-		fds[i].fd = (*ppfd)->fd;
-		fds[i].events = (*ppfd)->events;
-		(*ppfd)->revents = 0;
-	}
-	ret = poll(fds, nfds, ms);
-	if (ret) {
-		ppfd = polls;
-		for (i = 0; i < nfds; ++i, ++ppfd) {
-			(*ppfd)->revents = fds[i].revents;
-			if ((*ppfd)->revents && (*ppfd)->proc)
-				(*ppfd)->proc(ctx, *ppfd);
-		}
+	if (!ctx->initialized)
+		init_context(ctx);
+	ret = epoll_wait(ctx->epfd, evs, POLL_BATCH, ctx->ready ? 0 : ms);
+	if (ret < 0)
+		return ret;
+	for (i = 0; i < (unsigned)ret; ++i)
+		pending[i] = evs[i].data.ptr;
+	dispatch_pending(ctx, pending, ret, ret, evs);
+
+	/*
+	 * Always ready fds in batches. The one after a batch is kept in the
+	 * pending array too, so that removing it in a callback is noticed.
+	 */
+	for (pfd = ctx->ready; pfd; pfd = pending[n]) {
+		for (n = 0; pfd && n < POLL_BATCH; pfd = pfd->next)
+			pending[n++] = pfd;
+		pending[n] = pfd;
+		dispatch_pending(ctx, pending, n, n + 1, NULL);
+		ret += n;
 	}
 	return ret;
 }
 
+int timer_create_fd(struct poll_fd *pfd)
+{
+	pfd->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	pfd->events = POLLIN;
+	return pfd->fd;
+}
+
+void timer_set(struct poll_fd *pfd, unsigned ms, int interval)
+{
+	struct itimerspec its = {
+		.it_value = { .tv_sec = ms / 1000, .tv_nsec = ms % 1000 * 1000000L },
+	};
+
+	if (interval)
+		its.it_interval = its.it_value;
+	timerfd_settime(pfd->fd, 0, &its, NULL);
+}
+
+/* expirations since the last call, 0 if the timer did not fire */
+unsigned long timer_expirations(struct poll_fd *pfd)
+{
+	uint64_t n;
+
+	if (read(pfd->fd, &n, sizeof(n)) != sizeof(n))
+		return 0;
+	return n;
+}
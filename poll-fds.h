@@ -10,17 +10,37 @@ struct poll_fd
 	int fd;
 	short events, revents;
 	void (*proc)(struct poll_context *, struct poll_fd *);
+
+	/* registration in the poll_context */
+	struct poll_fd *prev, *next;
+	unsigned polled:1;
+	unsigned always_ready:1;
+	/* set by the owner: edge-triggered, each event is reported once */
+	unsigned edge:1;
 };
 
-#define MAX_POLL_ELEMENTS (100)
+/*
+ * The fds are watched with epoll. Those epoll refuses (regular files) are
+ * always ready, as poll() would report them.
+ */
 struct poll_context
 {
+	int epfd;
+	unsigned initialized:1;
 	unsigned npolls;
-	struct poll_fd *polls[MAX_POLL_ELEMENTS];
+	struct poll_fd *ready;
+	/* events being dispatched, remove_poll() cancels its own */
+	struct poll_fd **pending;
+	unsigned npending;
 };
 
 void add_poll(struct poll_context *, struct poll_fd *);
 void remove_poll(struct poll_context *, struct poll_fd *);
 int poll_fds(struct poll_context *, int ms);
 
+/* timerfd in a poll_fd: periodic if interval, stopped if ms is 0 */
+int timer_create_fd(struct poll_fd *);
+void timer_set(struct poll_fd *, unsigned ms, int interval);
+unsigned long timer_expirations(struct poll_fd *);
+
 #endif /* _POLL_FDS_H_ */
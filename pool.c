@@ -0,0 +1,159 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "pool.h"
+
+struct pool
+{
+	pthread_mutex_t lock;
+	pthread_cond_t work, done;
+	unsigned nthreads;
+	pthread_t *threads;
+	unsigned quit:1;
+
+	/* the current job */
+	unsigned long generation;
+	void (*fn)(void *, unsigned);
+	void *arg;
+	unsigned n, next, finished, active;
+};
+
+/* set while the thread runs a job, pool_run() from a job runs inline */
+static __thread int in_job;
+
+/* take indices of the job until there are none left, return how many */
+static unsigned run_job(struct pool *pool, void (*fn)(void *, unsigned), void *arg,
+			unsigned n)
+{
+	unsigned i, done = 0;
+
+	in_job = 1;
+	while ((i = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED)) < n) {
+		fn(arg, i);
+		++done;
+	}
+	in_job = 0;
+	return done;
+}
+
+/*
+ * Workers join a job under the lock and are counted as active until they
+ * left it. A worker may join after the job completed and pool_run()
+ * returned; it finds no indices left, and the next pool_run() waits for
+ * it to leave before it resets them.
+ */
+static void *worker(void *arg)
+{
+	struct pool *pool = arg;
+	unsigned long seen = 0;
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		void (*fn)(void *, unsigned);
+		void *job_arg;
+		unsigned n, done;
+
+		while (!pool->quit && pool->generation == seen)
+			pthread_cond_wait(&pool->work, &pool->lock);
+		if (pool->quit)
+			break;
+		seen = pool->generation;
+		fn = pool->fn;
+		job_arg = pool->arg;
+		n = pool->n;
+		pool->active++;
+		pthread_mutex_unlock(&pool->lock);
+		done = run_job(pool, fn, job_arg, n);
+		pthread_mutex_lock(&pool->lock);
+		pool->finished += done;
+		if (!--pool->active)
+			pthread_cond_broadcast(&pool->done);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+/* threads workers besides the caller, one per other CPU if 0 */
+struct pool *pool_new(unsigned threads)
+{
+	struct pool *pool = calloc(1, sizeof(*pool));
+	unsigned i;
+
+	if (!pool)
+		return NULL;
+	if (!threads) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+		threads = cpus > 1 ? cpus - 1 : 0;
+	}
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work, NULL);
+	pthread_cond_init(&pool->done, NULL);
+	pool->threads = calloc(threads ? threads : 1, sizeof(pthread_t));
+	if (!pool->threads) {
+		free(pool);
+		return NULL;
+	}
+	for (i = 0; i < threads; ++i)
+		if (pthread_create(pool->threads + i, NULL, worker, pool))
+			break;
+	pool->nthreads = i;
+	return pool;
+}
+
+void pool_free(struct pool *pool)
+{
+	unsigned i;
+
+	if (!pool)
+		return;
+	pthread_mutex_lock(&pool->lock);
+	pool->quit = 1;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+	for (i = 0; i < pool->nthreads; ++i)
+		pthread_join(pool->threads[i], NULL);
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->work);
+	pthread_cond_destroy(&pool->done);
+	free(pool->threads);
+	free(pool);
+}
+
+/* the calling thread included, 1 inside a job */
+unsigned pool_threads(const struct pool *pool)
+{
+	return pool && !in_job ? pool->nthreads + 1 : 1;
+}
+
+void pool_run(struct pool *pool, unsigned n, void (*fn)(void *arg, unsigned i), void *arg)
+{
+	unsigned i;
+
+	if (!pool || !pool->nthreads || n < 2 || in_job) {
+		for (i = 0; i < n; ++i)
+			fn(arg, i);
+		return;
+	}
+	pthread_mutex_lock(&pool->lock);
+	/* a late worker of the last job would take indices of this one */
+	while (pool->active)
+		pthread_cond_wait(&pool->done, &pool->lock);
+	pool->fn = fn;
+	pool->arg = arg;
+	pool->n = n;
+	pool->finished = 0;
+	pool->next = 0;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+
+	i = run_job(pool, fn, arg, n);
+
+	pthread_mutex_lock(&pool->lock);
+	pool->finished += i;
+	while (pool->finished < n || pool->active)
+		pthread_cond_wait(&pool->done, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,16 @@
+#ifndef _POOL_H_
+#define _POOL_H_ 1
+
+/*
+ * Fork-join worker threads: pool_run() calls fn(arg, i) for every i below
+ * n on the workers and the calling thread, and returns when all are done.
+ * Called from within a job, it runs the nested one inline.
+ */
+struct pool;
+
+struct pool *pool_new(unsigned threads);
+void pool_free(struct pool *);
+unsigned pool_threads(const struct pool *);
+void pool_run(struct pool *, unsigned n, void (*fn)(void *arg, unsigned i), void *arg);
+
+#endif /* _POOL_H_ */
@@ -0,0 +1,83 @@
+#include <stdint.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include "position.h"
+
+struct position
+{
+	unsigned seq; /* odd while being written */
+	off_t offset;
+	size_t size;
+	int fd; /* inherited by all views under the same number */
+};
+
+struct position *position_new(void)
+{
+	struct position *pos = mmap(NULL, sizeof(*pos), PROT_READ | PROT_WRITE,
+				    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+	if (pos == MAP_FAILED)
+		return NULL;
+	pos->fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (pos->fd == -1) {
+		munmap(pos, sizeof(*pos));
+		return NULL;
+	}
+	return pos;
+}
+
+int position_fd(const struct position *pos)
+{
+	return pos->fd;
+}
+
+void position_set(struct position *pos, unsigned *seen, off_t offset, size_t size)
+{
+	uint64_t one = 1;
+	unsigned seq;
+
+	/* a spinlock, the writer which made the sequence odd holds it */
+	for (;;) {
+		seq = __atomic_load_n(&pos->seq, __ATOMIC_RELAXED);
+		if (!(seq & 1) &&
+		    __atomic_compare_exchange_n(&pos->seq, &seq, seq + 1, 0,
+						__ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			break;
+		sched_yield();
+	}
+	/* the odd sequence is seen before the fields change */
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&pos->offset, offset, __ATOMIC_RELAXED);
+	__atomic_store_n(&pos->size, size, __ATOMIC_RELAXED);
+	__atomic_store_n(&pos->seq, seq + 2, __ATOMIC_RELEASE);
+	*seen = seq + 2;
+	write(pos->fd, &one, sizeof(one));
+}
+
+int position_get(struct position *pos, unsigned *seen, off_t *offset, size_t *size)
+{
+	unsigned seq;
+	off_t off;
+	size_t sz;
+
+	for (;;) {
+		seq = __atomic_load_n(&pos->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1) {
+			sched_yield();
+			continue;
+		}
+		off = __atomic_load_n(&pos->offset, __ATOMIC_RELAXED);
+		sz = __atomic_load_n(&pos->size, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&pos->seq, __ATOMIC_RELAXED) == seq)
+			break;
+	}
+	if (seq == *seen)
+		return 0;
+	*seen = seq;
+	*offset = off;
+	*size = sz;
+	return 1;
+}
@@ -0,0 +1,22 @@
+#ifndef _POSITION_H_
+#define _POSITION_H_ 1
+
+#include <sys/types.h>
+
+/*
+ * The block the linked views are on, in memory shared with the processes
+ * forked after position_new(). A seqlock: writers spin on its odd
+ * sequence as a spinlock, yielding the CPU between tries, readers retry
+ * until they got a consistent copy. Every write signals an eventfd
+ * which all views poll edge-triggered, nobody drains it.
+ */
+struct position;
+
+struct position *position_new(void);
+int position_fd(const struct position *);
+/* move the linked views there, *seen becomes the sequence of this write */
+void position_set(struct position *, unsigned *seen, off_t offset, size_t size);
+/* the latest position, 0 if it is the one of *seen already */
+int position_get(struct position *, unsigned *seen, off_t *offset, size_t *size);
+
+#endif /* _POSITION_H_ */
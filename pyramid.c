@@ -0,0 +1,297 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rawview.h"
+#include "pyramid.h"
+#include "pool.h"
+
+#define PYRAMID_HASH (1024)
+
+struct pyr_node
+{
+	struct pyr_node *hnext;
+	struct pyr_node *prev, *next;
+	unsigned level;
+	off_t index;
+	uint32_t bigram[BIGRAMS];
+};
+
+/*
+ * Every level has its own LRU list, so that streaming through the leaves
+ * of a huge block does not evict the upper nodes which make zooming cheap.
+ */
+struct pyr_level
+{
+	struct pyr_node *mru, *lru;
+	unsigned count;
+};
+
+struct pyramid
+{
+	struct pyr_node *hash[PYRAMID_HASH];
+	struct pyr_level level[PYRAMID_LEVELS];
+	unsigned long hits, misses;
+	struct pool *pool;
+};
+
+static inline unsigned node_shift(unsigned level)
+{
+	return PYRAMID_LEAF_SHIFT + level * PYRAMID_FANOUT_SHIFT;
+}
+
+static inline size_t node_size(unsigned level)
+{
+	return (size_t)1 << node_shift(level);
+}
+
+static inline unsigned hash_node(unsigned level, off_t index)
+{
+	return (unsigned)(index * 0x9e3779b1u + level) % PYRAMID_HASH;
+}
+
+/* nodes missing all of their children are counted on the pool */
+struct pyramid *pyramid_new(struct pool *pool)
+{
+	struct pyramid *p = calloc(1, sizeof(struct pyramid));
+
+	if (p)
+		p->pool = pool;
+	return p;
+}
+
+void pyramid_free(struct pyramid *p)
+{
+	unsigned i;
+
+	if (!p)
+		return;
+	for (i = 0; i < PYRAMID_HASH; ++i)
+		while (p->hash[i]) {
+			struct pyr_node *node = p->hash[i];
+
+			p->hash[i] = node->hnext;
+			free(node);
+		}
+	free(p);
+}
+
+static void lru_unlink(struct pyramid *p, struct pyr_node *node)
+{
+	struct pyr_level *l = &p->level[node->level];
+
+	if (node->prev)
+		node->prev->next = node->next;
+	else
+		l->mru = node->next;
+	if (node->next)
+		node->next->prev = node->prev;
+	else
+		l->lru = node->prev;
+	l->count--;
+}
+
+static void lru_push(struct pyramid *p, struct pyr_node *node)
+{
+	struct pyr_level *l = &p->level[node->level];
+
+	node->prev = NULL;
+	node->next = l->mru;
+	if (l->mru)
+		l->mru->prev = node;
+	else
+		l->lru = node;
+	l->mru = node;
+	l->count++;
+}
+
+static void hash_unlink(struct pyramid *p, struct pyr_node *node)
+{
+	struct pyr_node **pp = &p->hash[hash_node(node->level, node->index)];
+
+	while (*pp != node)
+		pp = &(*pp)->hnext;
+	*pp = node->hnext;
+}
+
+static struct pyr_node *lookup(struct pyramid *p, unsigned level, off_t index)
+{
+	struct pyr_node *node = p->hash[hash_node(level, index)];
+
+	while (node && (node->level != level || node->index != index))
+		node = node->hnext;
+	return node;
+}
+
+/* a free node, the least recently used one of the level if it is full */
+static struct pyr_node *alloc_node(struct pyramid *p, unsigned level)
+{
+	struct pyr_node *node = p->level[level].lru;
+
+	if (p->level[level].count < PYRAMID_LEVEL_NODES || !node)
+		return malloc(sizeof(*node));
+	lru_unlink(p, node);
+	hash_unlink(p, node);
+	return node;
+}
+
+static void insert_node(struct pyramid *p, struct pyr_node *node)
+{
+	node->hnext = p->hash[hash_node(node->level, node->index)];
+	p->hash[hash_node(node->level, node->index)] = node;
+	lru_push(p, node);
+}
+
+struct count_job
+{
+	const uint8_t *map;
+	struct pyr_node *node[1u << PYRAMID_FANOUT_SHIFT];
+};
+
+static void count_node(void *arg, unsigned k)
+{
+	struct count_job *job = arg;
+	struct pyr_node *node = job->node[k];
+	off_t off = node->index << node_shift(node->level);
+
+	memset(node->bigram, 0, sizeof(node->bigram));
+	bigram_count(node->bigram, job->map + off, node_size(node->level));
+}
+
+/*
+ * The children of a node none of which are kept are counted from the map
+ * in parallel: large ones one after the other, each split over the pool,
+ * smaller ones side by side, one per thread. They are the partial sums of
+ * the node, which get_node() adds up with the pairs between them.
+ */
+static void count_children(struct pyramid *p, const uint8_t *map,
+			   unsigned level, off_t index)
+{
+	struct count_job job = { .map = map };
+	unsigned threads = pool_threads(p->pool), k, n = 0;
+	off_t first = index << PYRAMID_FANOUT_SHIFT;
+
+	if (threads < 2)
+		return;
+	for (k = 0; k < 1u << PYRAMID_FANOUT_SHIFT; ++k)
+		if (lookup(p, level - 1, first + k))
+			return;
+	for (k = 0; k < 1u << PYRAMID_FANOUT_SHIFT; ++k) {
+		struct pyr_node *node = alloc_node(p, level - 1);
+
+		if (!node)
+			break;
+		node->level = level - 1;
+		node->index = first + k;
+		/* not looked up before it is counted, nor evicted by its siblings */
+		insert_node(p, node);
+		job.node[n++] = node;
+	}
+	if (node_size(level - 1) >= (size_t)threads * BIGRAM_PART_MIN)
+		for (k = 0; k < n; ++k) {
+			struct pyr_node *node = job.node[k];
+
+			memset(node->bigram, 0, sizeof(node->bigram));
+			bigram_count_pool(p->pool, node->bigram,
+					  map + (node->index << node_shift(level - 1)),
+					  node_size(level - 1));
+		}
+	else
+		pool_run(p->pool, n, count_node, &job);
+}
+
+/*
+ * The node is built off the lists, so that filling it from its children
+ * cannot evict it.
+ */
+static struct pyr_node *get_node(struct pyramid *p, const uint8_t *map,
+				 unsigned level, off_t index)
+{
+	struct pyr_node *node = lookup(p, level, index);
+	off_t off = index << node_shift(level);
+	unsigned k;
+
+	if (node) {
+		p->hits++;
+		lru_unlink(p, node);
+		lru_push(p, node);
+		return node;
+	}
+	p->misses++;
+	node = alloc_node(p, level);
+	if (!node)
+		return NULL;
+	node->level = level;
+	node->index = index;
+	memset(node->bigram, 0, sizeof(node->bigram));
+	if (level == 0)
+		bigram_count(node->bigram, map + off, node_size(0));
+	else {
+		count_children(p, map, level, index);
+		for (k = 0; k < 1u << PYRAMID_FANOUT_SHIFT; ++k) {
+			off_t coff = off + ((off_t)k << node_shift(level - 1));
+			struct pyr_node *child;
+
+			child = get_node(p, map, level - 1,
+					 (index << PYRAMID_FANOUT_SHIFT) + k);
+			if (!child) {
+				free(node);
+				return NULL;
+			}
+			bigram_add(node->bigram, child->bigram);
+			if (k) {
+				uint32_t *c = &node->bigram[BIGRAM(map[coff - 1], map[coff])];
+
+				*c = bigram_sat(*c, 1);
+			}
+		}
+	}
+	insert_node(p, node);
+	return node;
+}
+
+/*
+ * Add the bigrams of [off, off + size) to hist, return how much of it is
+ * inside the mapping. Only whole nodes are kept, the part of the input past
+ * the last complete leaf is always scanned.
+ */
+size_t pyramid_bigrams(struct pyramid *p, const uint8_t *map, off_t map_size,
+		       off_t off, size_t size, uint32_t hist[BIGRAMS])
+{
+	off_t pos = off, end = off + size;
+	unsigned long hits = p->hits, misses = p->misses;
+
+	if (end > map_size)
+		end = map_size;
+	while (pos < end) {
+		struct pyr_node *node = NULL;
+		unsigned level = PYRAMID_LEVELS;
+		off_t len;
+
+		if (pos > off) {
+			uint32_t *c = &hist[BIGRAM(map[pos - 1], map[pos])];
+
+			*c = bigram_sat(*c, 1);
+		}
+		while (level--) {
+			len = (off_t)1 << node_shift(level);
+			if (!(pos & (len - 1)) && pos + len <= end) {
+				node = get_node(p, map, level, pos >> node_shift(level));
+				break;
+			}
+		}
+		if (node) {
+			bigram_add(hist, node->bigram);
+			pos += len;
+			continue;
+		}
+		/* up to the next leaf boundary */
+		len = (((pos >> PYRAMID_LEAF_SHIFT) + 1) << PYRAMID_LEAF_SHIFT) - pos;
+		if (len > end - pos)
+			len = end - pos;
+		bigram_count(hist, map + pos, len);
+		pos += len;
+	}
+	trace("%s: %lld+%lu: %lu hits, %lu misses\n", __func__, (long long)off,
+	      (unsigned long)size, p->hits - hits, p->misses - misses);
+	return pos > off ? pos - off : 0;
+}
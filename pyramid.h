@@ -0,0 +1,30 @@
+#ifndef _PYRAMID_H_
+#define _PYRAMID_H_ 1
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "hist.h"
+
+/*
+ * Bigram histograms of aligned pieces of the input: 64KiB leaves, every
+ * level up 16 times larger. A block is the sum of the largest nodes which
+ * fit into it, plus its unaligned head and tail.
+ */
+#define PYRAMID_LEVELS (5)
+#define PYRAMID_LEAF_SHIFT (16)
+#define PYRAMID_FANOUT_SHIFT (4)
+/* nodes kept per level, 256KiB each */
+#define PYRAMID_LEVEL_NODES (64)
+/* smaller blocks are quicker to scan */
+#define PYRAMID_MIN_BLOCK (256 * 1024)
+
+struct pyramid;
+struct pool;
+
+struct pyramid *pyramid_new(struct pool *);
+void pyramid_free(struct pyramid *);
+size_t pyramid_bigrams(struct pyramid *, const uint8_t *map, off_t map_size,
+		       off_t off, size_t size, uint32_t hist[BIGRAMS]);
+
+#endif /* _PYRAMID_H_ */
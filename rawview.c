@@ -10,23 +10,31 @@
 #include <signal.h>
 #include <getopt.h>
 #include <sys/stat.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
 #include <xcb/xcb_keysyms.h>
 #include <X11/keysym.h>
 #include "utils.h"
 #include "rawview.h"
+#include "input.h"
+#include "classify.h"
+#include "image.h"
+#include "pyramid.h"
+#include "cache.h"
+#include "pool.h"
+#include "pipeline.h"
+#include "position.h"
+#include "spill.h"
+#include "stats.h"
+#include "spans.h"
+#include "sweep.h"
 
 #define DEFAULT_INPUT_BLOCK_SIZE (1024)
 #define AUTOSCROLL_MS (50)
-
-struct input
-{
-	struct poll_fd pfd;
-	off_t input_offset;
-	size_t input_size;
-	size_t amount;
-	size_t bufsize;
-	uint8_t buf[BUFSIZ];
-};
+/* a resized window is laid out once no configure came for this long */
+#define RESIZE_SETTLE_MS (100)
+/* a block being read is shown at most this often, -F */
+#define FRAME_MS (40)
 
 struct rawview
 {
@@ -34,31 +42,67 @@ struct rawview
 	char **argv;
 
 	int cmdout;
-	struct poll_fd cmdin;
+	/* the block of the linked views, NULL with -T */
+	struct position *position;
+	struct poll_fd linked;
+	unsigned linked_seen;
 
 	xcb_connection_t *connection;
 	xcb_key_symbols_t *keysyms;
-	struct window *view;
+	struct window *view; /* the windows, all on the same block */
 	struct input in;
 	struct poll_fd pfd;
+	struct pyramid *pyramid;
+	struct block_cache cache;
 
 	char *title;
 	unsigned autoscroll:1;
 	unsigned seekable:1;
+	unsigned threaded:1; /* -T: all views in this process */
+	unsigned jobs; /* -j: analysis threads, 0 for one per CPU */
+	unsigned uring:1; /* -U: read regular files on io_uring */
+	unsigned direct:1; /* -d: with O_DIRECT */
+	unsigned follow:1; /* -f: wait for the input to grow at its end */
+	struct poll_fd grown; /* inotify on a regular file, with -f */
+	size_t spill_cap; /* -S: bytes of a pipe kept, 0 for none */
+	struct pool *pool;
+	struct poll_fd scroll_timer;
+	struct poll_fd resize_timer;
+	struct poll_fd frame_timer;
+	unsigned frame_ms;
+	unsigned frame_due:1; /* the frame timer runs for what was read */
+	/* reads and analyzes the block on threads of its own, or NULL */
+	struct pipeline *pipeline;
+	struct poll_fd progress;
+	unsigned reading:1; /* the pipeline runs the block */
+	/* navigated: the block starts once the queued events are handled */
+	unsigned moved:1;
+	unsigned notify:1; /* and the other views follow */
+	unsigned sized:1; /* the views are set up for the new size first */
+	size_t amount; /* analyzed of the block, what the status shows */
+	/* pre-analyzes a neighbour of the block into the cache, or NULL */
+	struct pipeline *ahead;
+	struct input ahead_in;
+	struct poll_fd ahead_progress;
+	struct window *ahead_view; /* headless copies of the views */
+	int ahead_step; /* 1: the next block, -1: the previous one, 0: idle */
+	unsigned stats:1; /* -s: the counters in the status area, and at exit */
+	struct poll_fd dump; /* SIGUSR1: the counters on stderr */
 
 	/* Status area: color rainbow, stats, other text info */
 	unsigned int status_height;
 
-	/* Graph area */
+	/* Graph area, graph of the first view */
 	struct graph_desc *graph;
+	unsigned graph_width, graph_height; /* -g, 0 for the graph's default */
 };
 
 enum rawview_cmd
 {
 	RAWVIEW_CMD_NOP,
-	RAWVIEW_CMD_NOTIFY_READ_AT,
 	RAWVIEW_CMD_NEW_CONTI,
 	RAWVIEW_CMD_NEW_BYTES,
+	RAWVIEW_CMD_NEW_ENTROPY,
 };
 
 struct rawview_cmd_packet
@@ -66,6 +110,7 @@ struct rawview_cmd_packet
 	enum rawview_cmd cmd;
 	off_t input_offset;
 	size_t input_size;
+	uint64_t flow; /* spans_flow_id() of the sender */
 };
 
 char RAWVIEW[] = "rawview";
@@ -128,18 +173,64 @@ static void layout_rawview_window(struct window *view,
 	view->status_area.height = sub1(view->size.height, view->status_area.y + CONTENT_PAD_Y);
 }
 
+/* -M and -S: a number of MiB that fits into size_t as bytes */
+static size_t parse_mb(const char *arg)
+{
+	unsigned long long mb;
+	char *end;
+
+	errno = 0;
+	mb = strtoull(arg, &end, 0);
+	if (errno || end == arg || *end || strchr(arg, '-') || mb > SIZE_MAX >> 20) {
+		error("%s: size is a number of MiB up to %zu", arg, SIZE_MAX >> 20);
+		exit(2);
+	}
+	return (size_t)mb << 20;
+}
+
+/* -g applies to every view, whichever graph it shows */
+static int check_geometry(unsigned width, unsigned height)
+{
+	static const struct graph_desc *const graphs[] = {
+		&conti_graph, &bytes_graph, &entropy_graph,
+	};
+	unsigned i;
+
+	for (i = 0; i < countof(graphs); ++i)
+		if (width < graphs[i]->min_width || height < graphs[i]->min_height) {
+			error("%ux%u: the %s graph needs %ux%u at least", width, height,
+			      graphs[i]->name, graphs[i]->min_width, graphs[i]->min_height);
+			return -1;
+		}
+	return 0;
+}
+
+static unsigned graph_width(const struct rawview *prg, const struct graph_desc *gd)
+{
+	return prg->graph_width ? prg->graph_width : gd->width;
+}
+
+static unsigned graph_height(const struct rawview *prg, const struct graph_desc *gd)
+{
+	return prg->graph_height ? prg->graph_height : gd->height;
+}
+
 static const char font_name[] = "fixed";
 
-static struct window *create_rawview_window(struct rawview *prg, const char *icon)
+static struct window *create_rawview_window(struct rawview *prg, struct graph_desc *gd,
+					    const char *icon)
 {
 	uint32_t mask;
 	uint32_t values[5];
 	xcb_connection_t *c = prg->connection;
 	unsigned i;
 	struct window *view = calloc(1, sizeof(*view));
+	char title[256];
 
 	if (!view)
 		return NULL;
+	view->gd = gd;
+	snprintf(title, sizeof(title), "%s: (%s)", prg->title, gd->name);
 
 	/* get the first screen */
 	xcb_screen_t *screen = xcb_setup_roots_iterator(xcb_get_setup(c)).data;
@@ -153,17 +244,19 @@ static struct window *create_rawview_window(struct rawview *prg, const char *ico
 		{ &view->colors.green,       0,      0xffff, 0 },
 		{ &view->colors.blue,        0,      0,      0xffff },
 		{ &view->colors.border,      0x5fff, 0x5fff, 0x5fff },
-		{ view->colors.graph_fg + 0, 0x7fff, 0x7fff, 0x7fff },
-		{ view->colors.graph_fg + 1, 0x82ff, 0x00ff, 0x8eff },
-		{ view->colors.graph_fg + 2, 0xeaff, 0x00ff, 0xffff },
-		{ view->colors.graph_fg + 3, 0x10ff, 0x00ff, 0xa9ff },
-		{ view->colors.graph_fg + 4, 0x18ff, 0x00ff, 0xffff },
-		{ view->colors.graph_fg + 5, 0x00ff, 0xe4ff, 0xffff },
-		{ view->colors.graph_fg + 6, 0x00ff, 0xffff, 0x3cff },
-		{ view->colors.graph_fg + 7, 0xeaff, 0xffff, 0x00ff },
-		{ view->colors.graph_fg + 8, 0xffff, 0x84ff, 0x00ff },
-		{ view->colors.graph_fg + 9, 0xffff, 0x00ff, 0x00ff },
-		{ &view->colors.graph_bg,    0,      0,      0 },
+#define GRAPH_COLOR(ret, n) { ret, graph_rgb[n].r, graph_rgb[n].g, graph_rgb[n].b }
+		GRAPH_COLOR(view->colors.graph_fg + 0, GRAPH_FG(0)),
+		GRAPH_COLOR(view->colors.graph_fg + 1, GRAPH_FG(1)),
+		GRAPH_COLOR(view->colors.graph_fg + 2, GRAPH_FG(2)),
+		GRAPH_COLOR(view->colors.graph_fg + 3, GRAPH_FG(3)),
+		GRAPH_COLOR(view->colors.graph_fg + 4, GRAPH_FG(4)),
+		GRAPH_COLOR(view->colors.graph_fg + 5, GRAPH_FG(5)),
+		GRAPH_COLOR(view->colors.graph_fg + 6, GRAPH_FG(6)),
+		GRAPH_COLOR(view->colors.graph_fg + 7, GRAPH_FG(7)),
+		GRAPH_COLOR(view->colors.graph_fg + 8, GRAPH_FG(8)),
+		GRAPH_COLOR(view->colors.graph_fg + 9, GRAPH_FG(9)),
+		GRAPH_COLOR(&view->colors.graph_bg,    GRAPH_BG),
+#undef GRAPH_COLOR
 	};
 	for (i = 0; i < countof(colors); ++i)
 		colors[i].rq = xcb_alloc_color(c, screen->default_colormap,
@@ -179,6 +272,7 @@ static struct window *create_rawview_window(struct rawview *prg, const char *ico
 	}
 
 	view->c = c;
+	view->pool = prg->pool;
 	view->font = xcb_generate_id(view->c);
 	view->fg = xcb_generate_id(view->c);
 	view->graph_pid = xcb_generate_id(view->c);
@@ -187,8 +281,8 @@ static struct window *create_rawview_window(struct rawview *prg, const char *ico
 
 	view->size.x = 0;
 	view->size.y = 0;
-	view->size.width = prg->graph->width + 2 * CONTENT_PAD_X;
-	view->size.height = prg->graph->height + 2 * CONTENT_PAD_Y + prg->status_height + STATUS_PAD_Y;
+	view->size.width = graph_width(prg, gd) + 2 * CONTENT_PAD_X;
+	view->size.height = graph_height(prg, gd) + 2 * CONTENT_PAD_Y + prg->status_height + STATUS_PAD_Y;
 
 	mask = XCB_CW_BACK_PIXEL | XCB_CW_BORDER_PIXEL | XCB_CW_EVENT_MASK;
 	values[0] = view->colors.border;
@@ -213,9 +307,9 @@ static struct window *create_rawview_window(struct rawview *prg, const char *ico
 			    view->w,
 			    XCB_ATOM_WM_NAME,
 			    XCB_ATOM_STRING, 8,
-			    strlen(prg->title), prg->title);
+			    strlen(title), title);
 	if (!icon)
-		icon = prg->title;
+		icon = title;
 	xcb_change_property(view->c,
 			    XCB_PROP_MODE_REPLACE,
 			    view->w,
@@ -255,11 +349,14 @@ static struct window *create_rawview_window(struct rawview *prg, const char *ico
 	free(text_exts);
 	xcb_close_font(view->c, view->font);
 
-	layout_rawview_window(view, prg->graph->width, prg->graph->height);
+	layout_rawview_window(view, graph_width(prg, gd), graph_height(prg, gd));
 
-	/* graph area off-screen pixmap */
-	xcb_create_pixmap(view->c, screen->root_depth, view->graph_pid, view->w,
-			  view->graph_area.width, view->graph_area.height);
+	/* graph area off-screen pixmap and its client-side image */
+	fb_probe_shm(view);
+	if (fb_create(view)) {
+		free(view);
+		return NULL;
+	}
 	/* graph GC */
 	mask = XCB_GC_FOREGROUND | XCB_GC_BACKGROUND | XCB_GC_GRAPHICS_EXPOSURES;
 	values[0] = view->colors.graph_fg[0];
@@ -269,6 +366,13 @@ static struct window *create_rawview_window(struct rawview *prg, const char *ico
 	return view;
 }
 
+/* the foreground for what comes next, counted */
+static void set_fg(struct window *view, const uint32_t *pixel)
+{
+	xcb_change_gc(view->c, view->fg, XCB_GC_FOREGROUND, pixel);
+	stats_add(STAT_GC_CHANGES, 1);
+}
+
 static void update_status_area(struct window *view)
 {
 	const xcb_point_t line[2] = {
@@ -276,7 +380,7 @@ static void update_status_area(struct window *view)
 		{ view->status_area.x + view->status_area.width, view->status_area.y + view->font_base },
 	};
 
-	xcb_change_gc(view->c, view->fg, XCB_GC_FOREGROUND, view->colors.graph_fg);
+	set_fg(view, view->colors.graph_fg);
 	/* draw the baseline of the first line of status text */
 	xcb_poly_line(view->c, XCB_COORD_MODE_ORIGIN, view->w, view->fg, countof(line), line);
 	xcb_poly_rectangle(view->c, view->w, view->fg, 1, &view->status_area);
@@ -290,8 +394,11 @@ static void update_status_area(struct window *view)
 
 static void expose_view(struct window *view)
 {
+	uint64_t span = span_begin();
+	xcb_void_cookie_t last;
 	unsigned i;
 
+	fb_flush(view);
 	xcb_copy_area(view->c, view->graph_pid, view->w, view->fg,
 		      0, 0,
 		      view->graph_area.x, view->graph_area.y,
@@ -311,46 +418,225 @@ static void expose_view(struct window *view)
 		.width = step + rem / 2,
 		.height = 2
 	};
-	xcb_change_gc(view->c, view->fg, XCB_GC_FOREGROUND, view->colors.graph_fg);
+	set_fg(view, view->colors.graph_fg);
 	xcb_poly_fill_rectangle(view->c, view->w, view->fg, 1, &rt);
 	rt.width = step;
 	for (i = 1; i < countof(view->colors.graph_fg) - 1; ++i) {
 		rt.x += step;
-		xcb_change_gc(view->c, view->fg, XCB_GC_FOREGROUND, view->colors.graph_fg + i);
+		set_fg(view, view->colors.graph_fg + i);
 		xcb_poly_fill_rectangle(view->c, view->w, view->fg, 1, &rt);
 	}
-	xcb_change_gc(view->c, view->fg, XCB_GC_FOREGROUND, view->colors.graph_fg + i);
+	set_fg(view, view->colors.graph_fg + i);
 	rt.x += step;
 	rt.width = view->status_area.x + view->status_area.width - rt.x + 1;
-	xcb_poly_fill_rectangle(view->c, view->w, view->fg, 1, &rt);
+	last = xcb_poly_fill_rectangle(view->c, view->w, view->fg, 1, &rt);
 	xcb_flush(view->c);
+	stats_add(STAT_FLUSHES, 1);
+	stats_x_sequence(last.sequence);
+	span_end(__func__, span, "\"graph\":\"%s\"", view->gd->name);
+}
+
+static void input_read(struct rawview *);
+
+struct analyze_job
+{
+	struct window *views[16];
+	const uint8_t *data;
+	size_t count;
+};
+
+static void analyze_view(void *arg, unsigned i)
+{
+	struct analyze_job *job = arg;
+	struct window *view = job->views[i];
+	uint64_t span = span_begin();
+
+	view->gd->analyze(view, job->data, job->count);
+	span_end("analyze", span, "\"graph\":\"%s\",\"bytes\":%zu", view->gd->name, job->count);
 }
 
-static ssize_t read_input(struct input *in, struct window *view, size_t count)
+/*
+ * The data is read once for all views; with -T the views analyze it in
+ * parallel on the worker pool.
+ */
+static void analyze_views(struct rawview *prg, const uint8_t *data, size_t count)
+{
+	struct analyze_job job = { .data = data, .count = count };
+	struct window *view;
+	unsigned n = 0;
+	uint64_t start = stats_now();
+
+	for (view = prg->view; view; view = view->next) {
+		if (view->loaded)
+			continue;
+		job.views[n++] = view;
+		if (n == countof(job.views)) {
+			pool_run(prg->pool, n, analyze_view, &job);
+			n = 0;
+		}
+	}
+	pool_run(prg->pool, n, analyze_view, &job);
+	stats_add(STAT_ANALYZE_NS, stats_now() - start);
+}
+
+static ssize_t read_input(struct input *in, size_t count)
 {
 	struct rawview *prg = container_of(in, struct rawview, in);
-	ssize_t rd = read(in->pfd.fd, in->buf, count < in->bufsize ? count : in->bufsize);
+	const uint8_t *data;
+	uint64_t span = span_begin();
+	ssize_t rd = input_next(in, &data, count);
 
+	span_end(__func__, span, "\"bytes\":%zd", rd);
 	trace("%s[%ld]: %ld %s\n", __func__, (long)getpid(), (long)rd, rd < 0 ? strerror(errno) : "");
 	if (rd > 0)
-		in->amount += rd;
-	if (rd > 1)
-		prg->graph->analyze(view, in->buf, rd);
+		analyze_views(prg, data, rd);
+	prg->amount = in->amount;
+	input_read(prg);
+	/* another view may have refilled the spill while it was analyzed */
+	if (rd > 0 && input_first(in) > in->input_offset + (off_t)(in->amount - rd)) {
+		errno = ESPIPE;
+		return -1;
+	}
+	return rd;
+}
+
+/* the pipeline's analyzer thread, for all views */
+static void analyze_chunk(void *arg, const uint8_t buf[], size_t count)
+{
+	analyze_views(arg, buf, count);
+}
+
+/* the graphs are analyzed under the pipeline's lock, drawing takes it too */
+static void lock_views(struct rawview *prg)
+{
+	if (prg->pipeline)
+		pipeline_lock(prg->pipeline);
+}
+
+static void unlock_views(struct rawview *prg)
+{
+	if (prg->pipeline)
+		pipeline_unlock(prg->pipeline);
+}
+
+/* the input and the graphs are the event loop's alone until started again */
+static void stop_reading(struct rawview *prg)
+{
+	if (!prg->reading)
+		return;
+	pipeline_stop(prg->pipeline);
+	prg->reading = 0;
+}
+
+static void format_status(struct rawview *prg, struct window *view)
+{
+	const struct input *in = &prg->in;
+	int len;
+
 	snprintf(view->status_line1, sizeof(view->status_line1),
-		 in->amount != in->input_size ?
+		 prg->amount != in->input_size ?
 		 "0x%llx (%lu/%lx)" : "0x%llx (%lx)",
 		 (long long)in->input_offset,
-		 (unsigned long)in->amount,
+		 (unsigned long)prg->amount,
 		 (unsigned long)in->input_size);
-	snprintf(view->status_line2, sizeof(view->status_line2),
+	len = snprintf(view->status_line2, sizeof(view->status_line2),
 		 "%lld (%lu)", (long long)in->input_offset, (unsigned long)in->input_size);
+	if (prg->stats)
+		stats_format(view->status_line2, sizeof(view->status_line2));
+	else if (prg->cache.cap && len < (int)sizeof(view->status_line2))
+		snprintf(view->status_line2 + len, sizeof(view->status_line2) - len,
+			 " %lu/%lu", prg->cache.hits, prg->cache.hits + prg->cache.misses);
+}
+
+static void clear_status(struct window *view)
+{
 	xcb_clear_area(view->c, 0, view->w,
 		       view->status_area.x,
 		       view->status_area.y,
 		       view->status_area.width,
 		       view->status_area.height);
-	update_status_area(view);
-	return rd;
+}
+
+static void update_input_status(struct input *in)
+{
+	struct rawview *prg = container_of(in, struct rawview, in);
+	struct window *view;
+
+	for (view = prg->view; view; view = view->next) {
+		format_status(prg, view);
+		clear_status(view);
+		update_status_area(view);
+	}
+}
+
+static void show_view(struct window *view)
+{
+	if (view->gd->render && !view->cached)
+		view->gd->render(view);
+	expose_view(view);
+}
+
+static void count_frame(uint64_t start)
+{
+	uint64_t ns = stats_now() - start;
+
+	stats_add(STAT_FRAMES, 1);
+	stats_add(STAT_FRAME_NS, ns);
+	stats_max(STAT_FRAME_MAX_NS, ns);
+}
+
+static void show_graph(struct rawview *prg)
+{
+	struct window *view;
+	uint64_t start = stats_now();
+
+	lock_views(prg);
+	for (view = prg->view; view; view = view->next)
+		show_view(view);
+	unlock_views(prg);
+	count_frame(start);
+}
+
+/* status and graph of the block read so far, in one go per window */
+static void show_frame(struct rawview *prg)
+{
+	struct window *view;
+	uint64_t start = stats_now();
+
+	lock_views(prg);
+	for (view = prg->view; view; view = view->next) {
+		format_status(prg, view);
+		clear_status(view);
+		show_view(view);
+	}
+	unlock_views(prg);
+	count_frame(start);
+}
+
+/*
+ * Analysis runs at full speed, the windows only see what it got to once
+ * per frame: the first read after a frame starts the timer for the next.
+ */
+static void input_read(struct rawview *prg)
+{
+	if (!prg->frame_ms) {
+		show_frame(prg);
+		return;
+	}
+	if (prg->frame_due)
+		return;
+	prg->frame_due = 1;
+	timer_set(&prg->frame_timer, prg->frame_ms, 0);
+}
+
+/* the final frame of the block, once it is complete or cannot be */
+static void last_frame(struct rawview *prg)
+{
+	if (prg->frame_due) {
+		timer_set(&prg->frame_timer, 0, 0);
+		prg->frame_due = 0;
+	}
+	show_frame(prg);
 }
 
 enum rawview_event
@@ -363,15 +649,34 @@ enum rawview_event
 	RAWVIEW_EV_RIGHT,
 	RAWVIEW_EV_PLUS,
 	RAWVIEW_EV_MINUS,
+	RAWVIEW_EV_ZOOM_OUT,
+	RAWVIEW_EV_ZOOM_IN,
 	RAWVIEW_EV_AUTOSCROLL,
+	RAWVIEW_EV_STATS,
 	RAWVIEW_EV_RESIZE,
 	RAWVIEW_EV_NEW_CONTI_VIEW,
 	RAWVIEW_EV_NEW_CONTI_DETACHED_VIEW,
 	RAWVIEW_EV_NEW_BYTES_VIEW,
 	RAWVIEW_EV_NEW_BYTES_DETACHED_VIEW,
+	RAWVIEW_EV_NEW_ENTROPY_VIEW,
+	RAWVIEW_EV_NEW_ENTROPY_DETACHED_VIEW,
 };
 
-static enum rawview_event do_xcb_events(struct rawview *prg)
+static struct window *find_window(struct rawview *prg, xcb_window_t w)
+{
+	struct window *view;
+
+	for (view = prg->view; view; view = view->next)
+		if (view->w == w)
+			return view;
+	return NULL;
+}
+
+static void handle_event(struct rawview *, struct poll_context *, struct window *,
+			 enum rawview_event);
+
+/* handle the queued events, each for the window it was sent to */
+static void do_xcb_events(struct rawview *prg, struct poll_context *pctx)
 {
 	union {
 		xcb_generic_event_t *generic;
@@ -381,11 +686,13 @@ static enum rawview_event do_xcb_events(struct rawview *prg)
 		xcb_configure_notify_event_t *configure;
 		xcb_unmap_notify_event_t *unmap;
 		xcb_destroy_notify_event_t *destroy;
+		xcb_expose_event_t *expose;
 	} ev;
-	enum rawview_event ret = RAWVIEW_EV_NOP;
 
-	while ((ev.generic = xcb_poll_for_event(prg->connection))) {
+	while (prg->connection && (ev.generic = xcb_poll_for_event(prg->connection))) {
 		unsigned from_server = !(ev.generic->response_type & 0x80);
+		enum rawview_event ret = RAWVIEW_EV_NOP;
+		struct window *view = NULL;
 
 		if (ev.generic->response_type == 0) {
 			error("X11 error: code %u, seq %u resource %u, opcode %u.%u",
@@ -398,16 +705,19 @@ static enum rawview_event do_xcb_events(struct rawview *prg)
 			xcb_keysym_t key;
 
 		case XCB_UNMAP_NOTIFY:
-			if (ev.unmap->window == prg->view->w)
-				ret = RAWVIEW_EV_QUIT;
+			view = find_window(prg, ev.unmap->window);
+			ret = RAWVIEW_EV_QUIT;
 			break;
 
 		case XCB_DESTROY_NOTIFY:
-			if (ev.destroy->window == prg->view->w)
-				ret = RAWVIEW_EV_QUIT;
+			view = find_window(prg, ev.destroy->window);
+			ret = RAWVIEW_EV_QUIT;
 			break;
 
 		case XCB_CONFIGURE_NOTIFY:
+			view = find_window(prg, ev.configure->window);
+			if (!view)
+				break;
 			trace_if(2, "event %02x configure ev %lu wnd %lu above %lu x %d y %d, w %u h %u border %u over %u (was w %u h %u)\n",
 				 ev.configure->response_type,
 				 ev.configure->event,
@@ -419,17 +729,25 @@ static enum rawview_event do_xcb_events(struct rawview *prg)
 				 ev.configure->height,
 				 ev.configure->border_width,
 				 ev.configure->override_redirect,
-				 prg->view->size.width, prg->view->size.height);
+				 view->size.width, view->size.height);
+			/* moves and restacking do not change the layout */
+			if (ev.configure->width == view->size.width &&
+			    ev.configure->height == view->size.height)
+				break;
 			ret = RAWVIEW_EV_RESIZE;
-			prg->view->size.width = ev.configure->width;
-			prg->view->size.height = ev.configure->height;
+			view->size.width = ev.configure->width;
+			view->size.height = ev.configure->height;
 			break;
 
 		case XCB_EXPOSE:
-			ret = RAWVIEW_EV_EXPOSE;
+			/* the last one of a series */
+			view = find_window(prg, ev.expose->window);
+			if (!ev.expose->count)
+				ret = RAWVIEW_EV_EXPOSE;
 			break;
 
 		case XCB_KEY_PRESS:
+			view = find_window(prg, ev.key->event);
 			key = xcb_key_symbols_get_keysym(prg->keysyms, ev.key->detail, 0);
 
 			switch (key) {
@@ -440,6 +758,9 @@ static enum rawview_event do_xcb_events(struct rawview *prg)
 			case XK_a:
 				ret = RAWVIEW_EV_AUTOSCROLL;
 				break;
+			case XK_s:
+				ret = RAWVIEW_EV_STATS;
+				break;
 			case XK_r:
 			case XK_KP_Home:
 			case XK_Home:
@@ -466,6 +787,14 @@ static enum rawview_event do_xcb_events(struct rawview *prg)
 			case XK_minus:
 				ret = RAWVIEW_EV_MINUS;
 				break;
+			case XK_KP_Multiply:
+			case XK_asterisk:
+				ret = RAWVIEW_EV_ZOOM_OUT;
+				break;
+			case XK_KP_Divide:
+			case XK_slash:
+				ret = RAWVIEW_EV_ZOOM_IN;
+				break;
 			case XK_c:
 				if (ev.key->state & XCB_MOD_MASK_SHIFT)
 					ret = RAWVIEW_EV_NEW_CONTI_DETACHED_VIEW;
@@ -478,6 +807,12 @@ static enum rawview_event do_xcb_events(struct rawview *prg)
 				else
 					ret = RAWVIEW_EV_NEW_BYTES_VIEW;
 				break;
+			case XK_e:
+				if (ev.key->state & XCB_MOD_MASK_SHIFT)
+					ret = RAWVIEW_EV_NEW_ENTROPY_DETACHED_VIEW;
+				else
+					ret = RAWVIEW_EV_NEW_ENTROPY_VIEW;
+				break;
 #if 0
 			case XK_x:
 				ret = RAWVIEW_EV_NEW_HEX_VIEW;
@@ -508,8 +843,9 @@ static enum rawview_event do_xcb_events(struct rawview *prg)
 			break;
 		}
 		free(ev.generic);
+		if (view && ret != RAWVIEW_EV_NOP)
+			handle_event(prg, pctx, view, ret);
 	}
-	return ret;
 }
 
 struct well_known_atom ATOM;
@@ -541,13 +877,223 @@ fail:
 	return c;
 }
 
+/*
+ * Large blocks of mapped input are put together from the histogram pyramid
+ * instead of being read, for every view which takes bigrams. The bigrams
+ * are summed up once for all of them. Returns how much of the block they
+ * cover, 0 if nothing was loaded.
+ */
+static size_t load_pyramid_block(struct rawview *prg, struct window *views)
+{
+	static uint32_t hist[BIGRAMS];
+	struct input *in = &prg->in;
+	struct window *view;
+	size_t covered = 0;
+
+	if (!in->map || in->input_size < PYRAMID_MIN_BLOCK)
+		return 0;
+	for (view = views; view; view = view->next) {
+		if (view->loaded || !view->gd->add_bigrams)
+			continue;
+		if (!covered) {
+			if (!prg->pyramid)
+				prg->pyramid = pyramid_new(prg->pool);
+			if (!prg->pyramid)
+				return 0;
+			memset(hist, 0, sizeof(hist));
+			covered = pyramid_bigrams(prg->pyramid, in->map, in->map_size,
+						  in->input_offset, in->input_size, hist);
+			if (!covered)
+				return 0;
+		}
+		view->gd->add_bigrams(view, hist, in->map[in->input_offset + covered - 1]);
+		view->loaded = 1;
+	}
+	return covered;
+}
+
+static int cacheable(struct rawview *prg)
+{
+	return prg->cache.cap && (prg->in.map || prg->seekable);
+}
+
+static void block_key(struct rawview *prg, struct window *view, struct block_key *key)
+{
+	key->graph = view->gd->name;
+	key->offset = prg->in.input_offset;
+	key->size = prg->in.input_size;
+	key->width = view->fb.width;
+	key->height = view->fb.height;
+}
+
+/* a block seen before is shown as it was rendered, without reading it */
+static int load_cached_block(struct rawview *prg, struct window *view)
+{
+	struct block_key key;
+
+	view->cached = 0;
+	if (!cacheable(prg))
+		return 0;
+	block_key(prg, view, &key);
+	if (!cache_lookup(&prg->cache, &key, &view->fb))
+		return 0;
+	view->cached = 1;
+	view->loaded = 1;
+	return 1;
+}
+
+static void free_ahead_views(struct rawview *prg)
+{
+	struct window *view;
+
+	while ((view = prg->ahead_view)) {
+		prg->ahead_view = view->next;
+		if (view->gd->destroy)
+			view->gd->destroy(view);
+		fb_destroy(view);
+		free(view);
+	}
+}
+
+/* the graphs of another block analyzed without touching the windows' */
+static int new_ahead_views(struct rawview *prg)
+{
+	struct window *view, *copy, **pp = &prg->ahead_view;
+
+	free_ahead_views(prg);
+	for (view = prg->view; view; view = view->next) {
+		if (view->resized)
+			return -1;
+		copy = malloc(sizeof(*copy));
+		if (!copy)
+			return -1;
+		*copy = *view;
+		copy->c = NULL;
+		copy->pool = NULL; /* a background thread alone */
+		copy->priv = NULL;
+		copy->next = NULL;
+		copy->loaded = copy->cached = 0;
+		memset(&copy->fb, 0, sizeof(copy->fb));
+		if (fb_create(copy)) {
+			free(copy);
+			return -1;
+		}
+		*pp = copy;
+		pp = &copy->next;
+		if (copy->gd->setup)
+			copy->gd->setup(copy, prg->in.input_size);
+	}
+	return 0;
+}
+
+/* where Right (step 1) or Left (-1) goes, -1 if nowhere in the mapping */
+static off_t neighbour(struct rawview *prg, int step)
+{
+	off_t off = prg->in.input_offset, size = prg->in.input_size;
+
+	if (step > 0)
+		return off + size < prg->in.map_size ? off + size : -1;
+	if (!off)
+		return -1;
+	return off > size ? off - size : 0;
+}
+
+static int ahead_cached(struct rawview *prg, off_t off)
+{
+	struct window *view;
+	struct block_key key;
+
+	for (view = prg->view; view; view = view->next) {
+		block_key(prg, view, &key);
+		key.offset = off;
+		if (!cache_has(&prg->cache, &key))
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * While the block is looked at, the next one and then the previous one are
+ * analyzed on threads of their own and rendered into the cache: Right or
+ * Left then only swap the cached graph in. Mapped input only, the copies
+ * read it without disturbing the block's input.
+ */
+static void start_ahead(struct rawview *prg, int step)
+{
+	struct input *in = &prg->ahead_in;
+	struct window *view;
+	off_t off = -1;
+
+	if (!prg->ahead || !prg->in.map || !cacheable(prg) || prg->ahead_step)
+		return;
+	for (; step >= -1; step -= 2) {
+		off = neighbour(prg, step);
+		if (off != -1 && !ahead_cached(prg, off))
+			break;
+	}
+	if (step < -1 || new_ahead_views(prg))
+		return;
+	/* the mapping moves when a followed file grows */
+	in->map = prg->in.map;
+	in->map_size = prg->in.map_size;
+	in->map_chunk = prg->in.map_chunk;
+	in->input_offset = off;
+	in->input_size = prg->in.input_size;
+	input_start_block(in);
+	for (view = prg->ahead_view; view; view = view->next)
+		view->gd->start_block(view, off);
+	prg->ahead_step = step;
+	pipeline_start(prg->ahead);
+}
+
+static void stop_ahead(struct rawview *prg)
+{
+	if (!prg->ahead_step)
+		return;
+	pipeline_stop(prg->ahead);
+	prg->ahead_step = 0;
+}
+
+/* the ahead pipeline's analyzer thread */
+static void analyze_ahead(void *arg, const uint8_t buf[], size_t count)
+{
+	struct rawview *prg = arg;
+	struct window *view;
+
+	for (view = prg->ahead_view; view; view = view->next)
+		view->gd->analyze(view, buf, count);
+}
+
 static void start_redraw(struct rawview *prg)
 {
-	prg->in.amount = 0;
-	if (prg->seekable &&
+	struct window *view;
+	size_t covered;
+	int loaded = 1;
+	uint64_t span = span_begin();
+
+	stop_ahead(prg);
+	stop_reading(prg);
+	input_start_block(&prg->in);
+	prg->amount = 0;
+	for (view = prg->view; view; view = view->next) {
+		view->loaded = 0;
+		if (load_cached_block(prg, view))
+			continue;
+		view->gd->start_block(view, prg->in.input_offset);
+	}
+	if (prg->seekable && !prg->in.map && !prg->in.spill &&
 	    lseek(prg->in.pfd.fd, prg->in.input_offset, SEEK_SET) == -1 && ESPIPE == errno)
 		prg->seekable = 0;
-	prg->graph->start_block(prg->view, prg->in.input_offset);
+	covered = load_pyramid_block(prg, prg->view);
+	for (view = prg->view; view; view = view->next)
+		loaded &= view->loaded;
+	if (loaded) {
+		prg->in.amount = covered ? covered : prg->in.input_size;
+		prg->amount = prg->in.amount;
+		update_input_status(&prg->in);
+	}
+	span_end(__func__, span, "\"offset\":%lld,\"size\":%zu",
+		 (long long)prg->in.input_offset, prg->in.input_size);
 /*	xcb_clear_area(prg->view->c, 1, prg->view->w,
 		       0, 0, prg->view->size.width, prg->view->size.height); */
 }
@@ -559,9 +1105,16 @@ static void rawview_exec_view(struct rawview *prg, const char *view_name)
 		"-v", NULL,
 		"-O", NULL,
 		"-B", NULL,
+		"-C", (char *)bytes_classes->name,
+		"-M", NULL,
+		"-j", NULL,
+		"-F", NULL,
+		NULL, /* -U or -d */
+		NULL, /* -f */
 		NULL
 	};
-	char off[16], blk[16];
+	char **opt = argv + 15;
+	char off[16], blk[16], mb[16], jobs[16], frame[16];
 	switch (fork()) {
 	case -1:
 		error("%s: %s", view_name, strerror(errno));
@@ -575,6 +1128,16 @@ static void rawview_exec_view(struct rawview *prg, const char *view_name)
 		argv[2] = (char *)view_name;
 		argv[4] = off;
 		argv[6] = blk;
+		snprintf(mb, sizeof(mb), "%lu", (unsigned long)(prg->cache.cap >> 20));
+		argv[10] = mb;
+		snprintf(jobs, sizeof(jobs), "%u", prg->jobs);
+		argv[12] = jobs;
+		snprintf(frame, sizeof(frame), "%u", prg->frame_ms);
+		argv[14] = frame;
+		if (prg->uring)
+			*opt++ = prg->direct ? "-d" : "-U";
+		if (prg->follow)
+			*opt++ = "-f";
 		execve(argv[0], argv, __environ);
 		error("view %s: %s", view_name, strerror(errno));
 		_exit(3);
@@ -583,36 +1146,164 @@ static void rawview_exec_view(struct rawview *prg, const char *view_name)
 
 static void notify_read_at(struct rawview *prg)
 {
-	struct rawview_cmd_packet pkt = {
-		.cmd = RAWVIEW_CMD_NOTIFY_READ_AT,
+	uint64_t span;
+
+	if (!prg->position) /* -T, the views all move together */
+		return;
+	span = span_begin();
+	position_set(prg->position, &prg->linked_seen,
+		     prg->in.input_offset, prg->in.input_size);
+	span_flow("position", prg->linked_seen, 's');
+	span_end(__func__, span, "\"offset\":%lld", (long long)prg->in.input_offset);
+}
+
+/*
+ * Lay the graph out for the new window size. What the graph has analyzed
+ * so far is drawn again from memory when it can. Returns 0 if the graph
+ * does not keep enough of its analysis and the block needs to be read again.
+ */
+static int apply_resize(struct rawview *prg, struct window *view)
+{
+	struct graph_desc *gd = view->gd;
+
+	view->resized = 0;
+	view->status_area.width = view->size.width - 2 * CONTENT_PAD_Y;
+	if (!gd->setup)
+		return 1;
+	fb_destroy(view);
+	layout_rawview_window(view,
+		sub1(view->size.width, 2 * CONTENT_PAD_X),
+		sub1(view->size.height, STATUS_PAD_Y +
+		     view->status_area.height + 2 * CONTENT_PAD_Y));
+	if (fb_create(view)) {
+		error("out of memory");
+		exit(2);
+	}
+	gd->setup(view, prg->in.input_size);
+	return !view->cached && gd->redraw && gd->redraw(view);
+}
+
+/* the block is about to move, what is read of the current one is dropped */
+static void navigate(struct rawview *prg)
+{
+	stop_reading(prg);
+	prg->moved = 1;
+}
+
+/*
+ * Navigation only moves the block, it is started once the queued events
+ * are handled: a key held down reads and broadcasts the last position, not
+ * every one on the way.
+ */
+static void start_moved_block(struct rawview *prg, struct poll_context *pctx)
+{
+	struct window *view;
+
+	if (!prg->moved)
+		return;
+	if (prg->sized)
+		for (view = prg->view; view; view = view->next)
+			if (view->gd->setup)
+				view->gd->setup(view, prg->in.input_size);
+	if (prg->notify)
+		notify_read_at(prg);
+	prg->moved = 0;
+	prg->notify = 0;
+	prg->sized = 0;
+	start_redraw(prg);
+	add_poll(pctx, &prg->in.pfd);
+}
+
+static void set_block_size(struct rawview *prg, size_t size)
+{
+	if (size == prg->in.input_size)
+		return;
+	navigate(prg);
+	prg->in.input_size = size;
+	prg->sized = 1;
+	prg->notify = 1;
+}
+
+static void destroy_rawview_window(struct rawview *prg, struct window *view)
+{
+	struct window **pp;
+
+	/* out of the analyzer's sight, the others keep going */
+	lock_views(prg);
+	for (pp = &prg->view; *pp; pp = &(*pp)->next)
+		if (*pp == view) {
+			*pp = view->next;
+			break;
+		}
+	unlock_views(prg);
+	if (view->gd->destroy)
+		view->gd->destroy(view);
+	fb_destroy(view);
+	xcb_free_gc(view->c, view->graph);
+	xcb_free_gc(view->c, view->fg);
+	xcb_destroy_window(view->c, view->w);
+	xcb_flush(view->c);
+	free(view);
+}
+
+/* -T: one more window on the block in this process, else ask cmd_loop() */
+static void new_view(struct rawview *prg, struct poll_context *pctx,
+		     struct graph_desc *gd, enum rawview_cmd cmd)
+{
+	const struct rawview_cmd_packet pkt = {
+		.cmd = cmd,
 		.input_offset = prg->in.input_offset,
 		.input_size = prg->in.input_size,
+		.flow = span_flow_id(),
 	};
-	write(prg->cmdout, &pkt, sizeof(pkt));
-}
+	struct window *view, **pp;
 
-static void pfd_xcb_proc(struct poll_context *pctx, struct poll_fd *pfd)
-{
-	struct rawview *prg = container_of(pfd, struct rawview, pfd);
-	struct window *view = prg->view;
+	if (!prg->threaded) {
+		uint64_t span = span_begin();
 
-	if (pfd->revents & (POLLHUP|POLLNVAL)) {
-		remove_poll(pctx, pfd);
+		span_flow("cmd", pkt.flow, 's');
+		write(prg->cmdout, &pkt, sizeof(pkt));
+		span_end(__func__, span, "\"cmd\":%d", cmd);
 		return;
 	}
-	if (!(pfd->revents & POLLIN))
+	view = create_rawview_window(prg, gd, RAWVIEW);
+	if (!view) {
+		error("%s: out of memory", gd->name);
 		return;
+	}
+	if (gd->setup)
+		gd->setup(view, prg->in.input_size);
+	stop_reading(prg);
+	for (pp = &prg->view; *pp; pp = &(*pp)->next)
+		;
+	*pp = view;
+	xcb_map_window(prg->connection, view->w);
+	start_redraw(prg);
+	add_poll(pctx, &prg->in.pfd);
+}
 
-	switch (do_xcb_events(prg)) {
+static void handle_event(struct rawview *prg, struct poll_context *pctx,
+			 struct window *view, enum rawview_event ev)
+{
+	switch (ev) {
 		static int exposed;
 
 	case RAWVIEW_EV_NOP:
 		break;
 
 	case RAWVIEW_EV_QUIT:
+		destroy_rawview_window(prg, view);
+		if (prg->view)
+			break;
+		/*
+		 * Off epoll before the fd is closed: a forked view may still hold
+		 * the connection, which keeps it registered under a number the
+		 * next fd gets.
+		 */
+		remove_poll(pctx, &prg->pfd);
 		xcb_disconnect(prg->connection);
-		remove_poll(pctx, pfd);
-		pfd->fd = -1;
+		prg->connection = NULL;
+		prg->pfd.fd = -1;
 		break;
 
 	case RAWVIEW_EV_EXPOSE:
@@ -621,128 +1312,105 @@ static void pfd_xcb_proc(struct poll_context *pctx, struct poll_fd *pfd)
 			exposed = 1;
 			add_poll(pctx, &prg->in.pfd);
 		}
-		expose_view(prg->view);
+		lock_views(prg);
+		show_view(view);
+		unlock_views(prg);
 		break;
 
 	case RAWVIEW_EV_RESIZE:
-		view->status_area.width = view->size.width - 2 * CONTENT_PAD_Y;
-		if (prg->graph->setup) {
-			xcb_screen_t *screen = xcb_setup_roots_iterator(xcb_get_setup(view->c)).data;
-
-			xcb_free_pixmap(view->c, view->graph_pid);
-			layout_rawview_window(view,
-				sub1(view->size.width, 2 * CONTENT_PAD_X),
-				sub1(view->size.height, STATUS_PAD_Y +
-				     view->status_area.height + 2 * CONTENT_PAD_Y));
-			xcb_create_pixmap(view->c, screen->root_depth, view->graph_pid, view->w,
-					  view->graph_area.width, view->graph_area.height);
-			prg->graph->setup(view, prg->in.input_size);
-			// FIXME redraws too often, for every position change
-			start_redraw(prg);
-			add_poll(pctx, &prg->in.pfd);
-		}
-		expose_view(view);
+		/* applied once the size settled */
+		view->resized = 1;
+		timer_set(&prg->resize_timer, RESIZE_SETTLE_MS, 0);
 		break;
 
 	case RAWVIEW_EV_RIGHT:
+		navigate(prg);
 		if (!prg->autoscroll) {
 			prg->in.input_offset += prg->in.input_size;
-			notify_read_at(prg);
+			prg->notify = 1;
 		}
-		start_redraw(prg);
-		add_poll(pctx, &prg->in.pfd);
 		prg->autoscroll = 0;
 		break;
 
 	case RAWVIEW_EV_LEFT:
 		if (prg->seekable) {
+			off_t first = input_first(&prg->in);
 			off_t prev = prg->in.input_offset;
-			if (prg->in.input_offset > prg->in.input_size)
-				prg->in.input_offset -= prg->in.input_size;
-			else
-				prg->in.input_offset = 0;
-			if (prev != prg->in.input_offset) {
-				notify_read_at(prg);
-				start_redraw(prg);
-				add_poll(pctx, &prg->in.pfd);
+			off_t next = prev > first + (off_t)prg->in.input_size ?
+				     prev - (off_t)prg->in.input_size : first;
+
+			if (prev != next) {
+				navigate(prg);
+				prg->in.input_offset = next;
+				prg->notify = 1;
 			}
 			prg->autoscroll = 0;
 		}
 		break;
 
 	case RAWVIEW_EV_PLUS:
-		prg->in.input_size += 1024;
-		if (prg->graph->setup)
-			prg->graph->setup(prg->view, prg->in.input_size);
-		notify_read_at(prg);
-		start_redraw(prg);
-		add_poll(pctx, &prg->in.pfd);
+		set_block_size(prg, prg->in.input_size + 1024);
 		break;
 
 	case RAWVIEW_EV_MINUS:
-		{
-			size_t prev = prg->in.input_size;
-			if (prg->in.input_size > 1024)
-				prg->in.input_size -= 1024;
-			else
-				prg->in.input_size = 1024;
-			if (prev != prg->in.input_size) {
-				if (prg->graph->setup)
-					prg->graph->setup(prg->view, prg->in.input_size);
-				notify_read_at(prg);
-				start_redraw(prg);
-				add_poll(pctx, &prg->in.pfd);
-			}
-		}
+		set_block_size(prg, prg->in.input_size > 1024 ?
+			       prg->in.input_size - 1024 : 1024);
+		break;
+
+	case RAWVIEW_EV_ZOOM_OUT:
+		if (prg->in.input_size <= SIZE_MAX / 2)
+			set_block_size(prg, prg->in.input_size * 2);
+		break;
+
+	case RAWVIEW_EV_ZOOM_IN:
+		set_block_size(prg, prg->in.input_size > 2048 ?
+			       prg->in.input_size / 2 : 1024);
 		break;
 
 	case RAWVIEW_EV_RESTART:
 		if (prg->seekable) {
+			navigate(prg);
 			prg->autoscroll = 0;
-			prg->in.input_offset = 0;
-			notify_read_at(prg);
-			start_redraw(prg);
-			add_poll(pctx, &prg->in.pfd);
+			prg->in.input_offset = input_first(&prg->in);
+			prg->notify = 1;
 		}
 		break;
 
 	case RAWVIEW_EV_AUTOSCROLL:
 		prg->autoscroll = !prg->autoscroll;
+		if (prg->autoscroll)
+			timer_set(&prg->scroll_timer, AUTOSCROLL_MS, 1);
+		break;
+
+	case RAWVIEW_EV_STATS:
+		prg->stats = !prg->stats;
+		update_input_status(&prg->in);
 		break;
 
 	case RAWVIEW_EV_NEW_CONTI_VIEW:
-		{
-			const struct rawview_cmd_packet pkt = {
-				.cmd = RAWVIEW_CMD_NEW_CONTI,
-				.input_offset = prg->in.input_offset,
-				.input_size = prg->in.input_size,
-			};
-			write(prg->cmdout, &pkt, sizeof(pkt));
-		}
+		new_view(prg, pctx, &conti_graph, RAWVIEW_CMD_NEW_CONTI);
 		break;
 	case RAWVIEW_EV_NEW_CONTI_DETACHED_VIEW:
 		rawview_exec_view(prg, conti_graph.name);
 		break;
 	case RAWVIEW_EV_NEW_BYTES_VIEW:
-		{
-			const struct rawview_cmd_packet pkt = {
-				.cmd = RAWVIEW_CMD_NEW_BYTES,
-				.input_offset = prg->in.input_offset,
-				.input_size = prg->in.input_size,
-			};
-			write(prg->cmdout, &pkt, sizeof(pkt));
-		}
+		new_view(prg, pctx, &bytes_graph, RAWVIEW_CMD_NEW_BYTES);
 		break;
 	case RAWVIEW_EV_NEW_BYTES_DETACHED_VIEW:
 		rawview_exec_view(prg, bytes_graph.name);
 		break;
+	case RAWVIEW_EV_NEW_ENTROPY_VIEW:
+		new_view(prg, pctx, &entropy_graph, RAWVIEW_CMD_NEW_ENTROPY);
+		break;
+	case RAWVIEW_EV_NEW_ENTROPY_DETACHED_VIEW:
+		rawview_exec_view(prg, entropy_graph.name);
+		break;
 	}
 }
 
-static void pfd_viewcmd_proc(struct poll_context *pctx, struct poll_fd *pfd)
+static void pfd_xcb_proc(struct poll_context *pctx, struct poll_fd *pfd)
 {
-	struct rawview_cmd_packet pkt;
-	struct rawview *prg = container_of(pfd, struct rawview, cmdin);
+	struct rawview *prg = container_of(pfd, struct rawview, pfd);
 
 	if (pfd->revents & (POLLHUP|POLLNVAL)) {
 		remove_poll(pctx, pfd);
@@ -750,21 +1418,65 @@ static void pfd_viewcmd_proc(struct poll_context *pctx, struct poll_fd *pfd)
 	}
 	if (!(pfd->revents & POLLIN))
 		return;
-	if (read(pfd->fd, &pkt, sizeof(pkt)) != sizeof(pkt))
+	do_xcb_events(prg, pctx);
+	start_moved_block(prg, pctx);
+}
+
+/* another view moved, only the latest position is read */
+static void pfd_linked_proc(struct poll_context *pctx, struct poll_fd *pfd)
+{
+	struct rawview *prg = container_of(pfd, struct rawview, linked);
+	off_t offset;
+	size_t size;
+	uint64_t span = span_begin();
+
+	if (!position_get(prg->position, &prg->linked_seen, &offset, &size))
+		return;
+	/* every linked view got the same write */
+	span_flow("position", prg->linked_seen, 't');
+	navigate(prg);
+	prg->autoscroll = 0;
+	prg->in.input_offset = offset;
+	if (size != prg->in.input_size)
+		prg->sized = 1;
+	prg->in.input_size = size;
+	start_moved_block(prg, pctx);
+	span_end(__func__, span, "\"offset\":%lld", (long long)offset);
+}
+
+/*
+ * The block is on screen: while it is looked at, have the kernel read the
+ * blocks the next Right or Left will need, and analyze them if mapped.
+ */
+static void block_done(struct rawview *prg, struct poll_context *pctx)
+{
+	struct window *view;
+
+	last_frame(prg);
+	remove_poll(pctx, &prg->in.pfd);
+	for (view = prg->view; view && cacheable(prg); view = view->next) {
+		struct block_key key;
+
+		if (view->cached)
+			continue;
+		block_key(prg, view, &key);
+		cache_store(&prg->cache, &key, &view->fb);
+	}
+	input_prefetch(&prg->in);
+	start_ahead(prg, 1);
+}
+
+/* the input ended before the block: -f waits for more, else autoscroll stops */
+static void input_ended(struct rawview *prg, struct poll_context *pctx, int err)
+{
+	last_frame(prg);
+	if (err)
+		trace("%s: %s\n", __func__, strerror(err));
+	else if (prg->grown.fd != -1) {
+		add_poll(pctx, &prg->grown);
 		return;
-	switch (pkt.cmd) {
-	case RAWVIEW_CMD_NOP:
-		break;
-	case RAWVIEW_CMD_NOTIFY_READ_AT:
-		prg->autoscroll = 0;
-		prg->in.input_offset = pkt.input_offset;
-		prg->in.input_size = pkt.input_size;
-		start_redraw(prg);
-		add_poll(pctx, &prg->in.pfd);
-		break;
-	default:
-		break;
 	}
+	prg->autoscroll = 0;
 }
 
 static void pfd_input_proc(struct poll_context *pctx, struct poll_fd *pfd)
@@ -779,37 +1491,271 @@ static void pfd_input_proc(struct poll_context *pctx, struct poll_fd *pfd)
 	if (!(pfd->revents & POLLIN))
 		return;
 	if (in->amount >= in->input_size) {
+		/* completed by start_redraw() */
+		block_done(prg, pctx);
+		return;
+	}
+	if (prg->pipeline) {
+		/* the threads take it from here, pfd_progress_proc() hears back */
 		remove_poll(pctx, pfd);
+		if (!prg->reading) {
+			prg->reading = 1;
+			pipeline_start(prg->pipeline);
+		}
 		return;
 	}
-	ssize_t rd = read_input(in, prg->view, in->input_size - in->amount);
+	ssize_t rd = read_input(in, in->input_size - in->amount);
 	if (rd > 0) {
-		if (in->amount >= in->input_size) {
-			expose_view(prg->view);
-			remove_poll(pctx, pfd);
-		}
+		if (in->amount >= in->input_size)
+			block_done(prg, pctx);
+	} else if (rd < 0 && errno == EAGAIN) {
+		/* another view got to the pipe first, more comes with the next data */
 	} else {
-		expose_view(prg->view);
+		int err = rd < 0 ? errno : 0;
+
 		remove_poll(pctx, pfd);
-		prg->autoscroll = 0;
+		input_ended(prg, pctx, err);
+	}
+}
+
+static void pfd_progress_proc(struct poll_context *pctx, struct poll_fd *pfd)
+{
+	struct rawview *prg = container_of(pfd, struct rawview, progress);
+	size_t amount;
+	int state = pipeline_progress(prg->pipeline, &amount);
+	int err;
+
+	if (!prg->reading) /* a cancelled block */
+		return;
+	prg->amount = amount;
+	if (!state) {
+		input_read(prg);
+		return;
+	}
+	err = errno;
+	stop_reading(prg);
+	if (state > 0)
+		block_done(prg, pctx);
+	else
+		input_ended(prg, pctx, err);
+}
+
+/* a neighbour is analyzed: rendered into the cache, then the other one */
+static void pfd_ahead_proc(struct poll_context *pctx, struct poll_fd *pfd)
+{
+	struct rawview *prg = container_of(pfd, struct rawview, ahead_progress);
+	struct window *view;
+	size_t amount;
+	int state = pipeline_progress(prg->ahead, &amount);
+	int step = prg->ahead_step;
+
+	if (!step || !state) /* cancelled, or not done yet */
+		return;
+	stop_ahead(prg);
+	for (view = prg->ahead_view; state > 0 && view; view = view->next) {
+		struct block_key key = {
+			.graph = view->gd->name,
+			.offset = prg->ahead_in.input_offset,
+			.size = prg->ahead_in.input_size,
+			.width = view->fb.width,
+			.height = view->fb.height,
+		};
+
+		if (view->gd->render)
+			view->gd->render(view);
+		cache_store(&prg->cache, &key, &view->fb);
+	}
+	if (step > 0)
+		start_ahead(prg, -1);
+}
+
+/* the file was written to, the block goes on where it ended */
+static void pfd_grown_proc(struct poll_context *pctx, struct poll_fd *pfd)
+{
+	struct rawview *prg = container_of(pfd, struct rawview, grown);
+	struct window *view;
+	char events[4096];
+
+	while (read(pfd->fd, events, sizeof(events)) > 0)
+		;
+	/* moved on since, the watch is added again if that block ends short */
+	if (prg->reading || prg->in.pfd.polled || prg->in.amount >= prg->in.input_size) {
+		remove_poll(pctx, pfd);
+		return;
+	}
+	stop_ahead(prg);
+	if (!input_grow(&prg->in))
+		return;
+	/*
+	 * The pyramid loaded them up to the old end, the rest is analyzed, from
+	 * the pair across it on.
+	 */
+	for (view = prg->view; view; view = view->next)
+		view->loaded = 0;
+	remove_poll(pctx, pfd);
+	add_poll(pctx, &prg->in.pfd);
+}
+
+static void pfd_frame_timer_proc(struct poll_context *pctx, struct poll_fd *pfd)
+{
+	struct rawview *prg = container_of(pfd, struct rawview, frame_timer);
+
+	if (!timer_expirations(pfd))
+		return;
+	prg->frame_due = 0;
+	show_frame(prg);
+}
+
+static void pfd_dump_proc(struct poll_context *pctx, struct poll_fd *pfd)
+{
+	struct signalfd_siginfo si;
+
+	while (read(pfd->fd, &si, sizeof(si)) == sizeof(si))
+		stats_dump();
+}
+
+static void pfd_resize_timer_proc(struct poll_context *pctx, struct poll_fd *pfd)
+{
+	struct rawview *prg = container_of(pfd, struct rawview, resize_timer);
+	struct window *view;
+	int redrawn = 1;
+
+	if (!timer_expirations(pfd))
+		return;
+	lock_views(prg);
+	for (view = prg->view; view; view = view->next)
+		if (view->resized)
+			redrawn &= apply_resize(prg, view);
+	unlock_views(prg);
+	if (!redrawn) {
+		trace("%s: reading the block again\n", __func__);
+		start_redraw(prg);
+		add_poll(pctx, &prg->in.pfd);
+	}
+	show_graph(prg);
+}
+
+/* the next block once the current one is complete, the timer stops itself */
+static void pfd_scroll_timer_proc(struct poll_context *pctx, struct poll_fd *pfd)
+{
+	struct rawview *prg = container_of(pfd, struct rawview, scroll_timer);
+
+	if (!timer_expirations(pfd))
+		return;
+	if (!prg->autoscroll) {
+		timer_set(pfd, 0, 0);
+		return;
+	}
+	if (prg->amount >= prg->in.input_size) {
+		prg->in.input_offset += prg->in.input_size;
+		notify_read_at(prg);
+		start_redraw(prg);
+		add_poll(pctx, &prg->in.pfd);
+	}
+}
+
+/*
+ * The threads the views analyze on, started in the process which shows
+ * them. Mapped input is handed out in pieces for all of them at once.
+ */
+static void start_pool(struct rawview *prg)
+{
+	if (prg->jobs != 1)
+		prg->pool = pool_new(prg->jobs ? prg->jobs - 1 : 0);
+	prg->in.map_chunk = INPUT_MAP_CHUNK * pool_threads(prg->pool);
+}
+
+/* io_uring is set up per process too, if it cannot the file is mapped */
+static void start_input(struct rawview *prg)
+{
+	if (!prg->uring || prg->in.ring)
+		return;
+	if (input_uring(&prg->in, prg->direct) == -1) {
+		trace("%s: no io_uring, mapping the input\n", __func__);
+		input_map(&prg->in);
 	}
 }
 
+/* -f: regular files are watched for appends, a pipe is waited on anyway */
+static void start_follow(struct rawview *prg)
+{
+	struct stat st;
+	char path[32];
+
+	prg->grown.fd = -1;
+	if (!prg->follow || fstat(prg->in.pfd.fd, &st) == -1 || !S_ISREG(st.st_mode))
+		return;
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", prg->in.pfd.fd);
+	prg->grown.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (prg->grown.fd == -1 || inotify_add_watch(prg->grown.fd, path, IN_MODIFY) == -1) {
+		error("follow: %s", strerror(errno));
+		if (prg->grown.fd != -1)
+			close(prg->grown.fd);
+		prg->grown.fd = -1;
+		return;
+	}
+	prg->grown.events = POLLIN;
+	prg->grown.proc = pfd_grown_proc;
+}
+
+/*
+ * A pipe is read into the spill from now on, set up before the views are
+ * forked so that they all read it from there. It makes the input seekable
+ * as far back as the spill goes.
+ */
+static void start_spill(struct rawview *prg)
+{
+	int flags;
+
+	if (prg->in.map || prg->seekable || !prg->spill_cap)
+		return;
+	prg->in.spill = spill_new(prg->spill_cap);
+	if (!prg->in.spill) {
+		error("spill: %s", strerror(errno));
+		return;
+	}
+	/* whoever finds the pipe empty looks into the spill again */
+	flags = fcntl(prg->in.pfd.fd, F_GETFL);
+	if (flags != -1)
+		fcntl(prg->in.pfd.fd, F_SETFL, flags | O_NONBLOCK);
+	prg->seekable = 1;
+}
+
+/* main() blocked SIGUSR1, every view process dumps its own counters */
+static void start_dump(struct rawview *prg, struct poll_context *pctx)
+{
+	sigset_t set;
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGUSR1);
+	prg->dump.fd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (prg->dump.fd == -1) {
+		trace("%s: %s\n", __func__, strerror(errno));
+		return;
+	}
+	prg->dump.events = POLLIN;
+	prg->dump.proc = pfd_dump_proc;
+	add_poll(pctx, &prg->dump);
+}
+
 static int view_loop(struct rawview *prg, const char *input_name)
 {
 	static struct poll_context ctx = { 0, };
-	int timeout;
 	size_t size = strlen(RAWVIEW) + strlen(input_name) + 32;
 
+	spans_process(prg->graph->name);
+	start_pool(prg);
+	start_input(prg);
+	start_follow(prg);
 	prg->title = malloc(size);
-	snprintf(prg->title, size, "%s: %s: (%s)", RAWVIEW, input_name, prg->graph->name);
+	snprintf(prg->title, size, "%s: %s", RAWVIEW, input_name);
 	prg->connection = connect_x_server();
 	if (!prg->connection) {
 		error("cannot connect to DISPLAY");
 		exit(2);
 	}
 	prg->keysyms = xcb_key_symbols_alloc(prg->connection);
-	prg->view = create_rawview_window(prg, RAWVIEW);
+	prg->view = create_rawview_window(prg, prg->graph, RAWVIEW);
 	if (!prg->view) {
 		error("out of memory");
 		exit(2);
@@ -817,8 +1763,13 @@ static int view_loop(struct rawview *prg, const char *input_name)
 
 	prg->pfd.fd = xcb_get_file_descriptor(prg->connection);
 	add_poll(&ctx, &prg->pfd);
-	if (prg->cmdin.fd != -1)
-		add_poll(&ctx, &prg->cmdin);
+	if (prg->position) {
+		prg->linked.fd = position_fd(prg->position);
+		prg->linked.events = POLLIN;
+		prg->linked.edge = 1;
+		prg->linked.proc = pfd_linked_proc;
+		add_poll(&ctx, &prg->linked);
+	}
 
 	if (prg->graph->setup)
 		prg->graph->setup(prg->view, prg->in.input_size);
@@ -828,37 +1779,62 @@ static int view_loop(struct rawview *prg, const char *input_name)
 	xcb_map_window(prg->connection, prg->view->w);
 	xcb_flush(prg->connection);
 
-	timeout = prg->autoscroll ? AUTOSCROLL_MS : -1;
-
-	while (ctx.npolls) {
-		int n = poll_fds(&ctx, timeout);
+	prg->scroll_timer.proc = pfd_scroll_timer_proc;
+	prg->resize_timer.proc = pfd_resize_timer_proc;
+	prg->frame_timer.proc = pfd_frame_timer_proc;
+	if (timer_create_fd(&prg->scroll_timer) == -1 ||
+	    timer_create_fd(&prg->resize_timer) == -1 ||
+	    timer_create_fd(&prg->frame_timer) == -1) {
+		error("timerfd: %s", strerror(errno));
+		exit(2);
+	}
+	add_poll(&ctx, &prg->scroll_timer);
+	add_poll(&ctx, &prg->resize_timer);
+	add_poll(&ctx, &prg->frame_timer);
+
+	prg->pipeline = pipeline_new(&prg->in, analyze_chunk, prg);
+	if (prg->pipeline) {
+		prg->progress.fd = pipeline_fd(prg->pipeline);
+		prg->progress.events = POLLIN;
+		prg->progress.proc = pfd_progress_proc;
+		add_poll(&ctx, &prg->progress);
+	} else
+		trace("no pipeline, reading on the event loop\n");
+	prg->ahead_in.map = prg->in.map; /* no buffers for it */
+	if (prg->in.map && prg->cache.cap)
+		prg->ahead = pipeline_new(&prg->ahead_in, analyze_ahead, prg);
+	if (prg->ahead) {
+		prg->ahead_progress.fd = pipeline_fd(prg->ahead);
+		prg->ahead_progress.events = POLLIN;
+		prg->ahead_progress.proc = pfd_ahead_proc;
+		add_poll(&ctx, &prg->ahead_progress);
+	}
+	if (prg->autoscroll)
+		timer_set(&prg->scroll_timer, AUTOSCROLL_MS, 1);
+	start_dump(prg, &ctx);
 
+	/* until the X connection is gone */
+	while (prg->pfd.polled) {
+		poll_fds(&ctx, -1);
 		if (prg->pfd.fd == -1) /* quit */
 			break;
-		if (prg->autoscroll)
-			timeout = AUTOSCROLL_MS;
-		if (n <= 0) {
-			if (prg->autoscroll &&
-			    n == 0 &&
-			    prg->in.amount >= prg->in.input_size) {
-				prg->in.input_offset += prg->in.input_size;
-				notify_read_at(prg);
-				start_redraw(prg);
-				add_poll(&ctx, &prg->in.pfd);
-			}
-		}
 	}
+	if (prg->stats)
+		stats_dump();
 	return 0;
 }
 
 struct rawview_client
 {
+	struct rawview_client *prev, *next;
 	struct rawview *prg;
 	const char *input_name;
-	int out;
 	struct poll_fd in;
 };
 
+/* the views of cmd_loop() */
+static struct rawview_client *clients;
+
 static void cmd_input_proc(struct poll_context *pctx, struct poll_fd *pfd);
 
 static struct rawview_client *new_rawview_client(struct rawview *prg,
@@ -867,16 +1843,13 @@ static struct rawview_client *new_rawview_client(struct rawview *prg,
 						 off_t input_offset,
 						 size_t input_size)
 {
-	int cmdout[2];
 	int cmdin[2];
 	struct rawview_client *client = calloc(1, sizeof(*client));
 
 	if (!client)
 		goto fail_alloc;
-	if (pipe(cmdout) == -1)
-		goto fail_alloc;
 	if (pipe(cmdin) == -1)
-		goto fail_in;
+		goto fail_alloc;
 	switch (fork()) {
 	case -1:
 		error("%s: %s", gd->name, strerror(errno));
@@ -885,25 +1858,23 @@ static struct rawview_client *new_rawview_client(struct rawview *prg,
 	default:
 		client->prg = prg;
 		client->input_name = input_name;
-		client->out = cmdout[1];
-		set_closexec(client->out);
 		client->in.events = POLLIN;
 		client->in.proc = cmd_input_proc;
 		client->in.fd = cmdin[0];
 		set_closexec(client->in.fd);
-		close(cmdout[0]);
 		close(cmdin[1]);
+		client->next = clients;
+		if (clients)
+			clients->prev = client;
+		clients = client;
 		break;
 
 	case 0:
 		free(client); /* not used here in the client */
-		set_closexec(cmdout[0]);
 		set_closexec(cmdin[1]);
-		close(cmdout[1]);
 		close(cmdin[0]);
 		prg->cmdout = cmdin[1];
-		prg->cmdin.fd = cmdout[0];
-		if (lseek(prg->in.pfd.fd, input_offset, SEEK_SET) == -1) {
+		if (!prg->in.spill && lseek(prg->in.pfd.fd, input_offset, SEEK_SET) == -1) {
 			input_offset = 0;
 			prg->seekable = 0;
 			error("%s: %s: seek: %s", gd->name, input_name, strerror(errno));
@@ -917,9 +1888,6 @@ static struct rawview_client *new_rawview_client(struct rawview *prg,
 fail_fork:
 	close(cmdin[0]);
 	close(cmdin[1]);
-fail_in:
-	close(cmdout[0]);
-	close(cmdout[1]);
 fail_alloc:
 	free(client);
 	return NULL;
@@ -927,8 +1895,12 @@ fail_alloc:
 
 static void free_rawview_client(struct rawview_client *client)
 {
-	if (client->out != -1)
-		close(client->out);
+	if (client->prev)
+		client->prev->next = client->next;
+	else
+		clients = client->next;
+	if (client->next)
+		client->next->prev = client->prev;
 	if (client->in.fd != -1)
 		close(client->in.fd);
 	free(client);
@@ -939,6 +1911,7 @@ static void cmd_input_proc(struct poll_context *pctx, struct poll_fd *pfd)
 	struct rawview_cmd_packet pkt;
 	struct rawview_client *client = container_of(pfd, struct rawview_client, in);
 	struct rawview *prg = client->prg;
+	uint64_t span;
 
 	if (pfd->revents & (POLLHUP|POLLNVAL)) {
 		remove_poll(pctx, pfd);
@@ -947,16 +1920,16 @@ static void cmd_input_proc(struct poll_context *pctx, struct poll_fd *pfd)
 	}
 	if (!(pfd->revents & POLLIN))
 		return;
+	span = span_begin();
 	if (read(pfd->fd, &pkt, sizeof(pkt)) != sizeof(pkt))
 		return;
+	span_flow("cmd", pkt.flow, 'f');
 	switch (pkt.cmd) {
 		struct rawview_client *newc;
 
 	case RAWVIEW_CMD_NOP:
 		break;
 	case RAWVIEW_CMD_NEW_CONTI:
-		if (pctx->npolls == MAX_POLL_ELEMENTS - 1)
-			break;
 		newc = new_rawview_client(prg, &conti_graph,
 					  client->input_name,
 					  pkt.input_offset,
@@ -966,8 +1939,6 @@ static void cmd_input_proc(struct poll_context *pctx, struct poll_fd *pfd)
 		add_poll(pctx, &newc->in);
 		break;
 	case RAWVIEW_CMD_NEW_BYTES:
-		if (pctx->npolls == MAX_POLL_ELEMENTS - 1)
-			break;
 		newc = new_rawview_client(prg, &bytes_graph,
 					  client->input_name,
 					  pkt.input_offset,
@@ -976,29 +1947,127 @@ static void cmd_input_proc(struct poll_context *pctx, struct poll_fd *pfd)
 			break;
 		add_poll(pctx, &newc->in);
 		break;
-	case RAWVIEW_CMD_NOTIFY_READ_AT:
-		trace("read at %lld %u\n", pkt.input_offset, pkt.input_size);
-		{
-			unsigned i;
-			for (i = 0; i < pctx->npolls; ++i) {
-				struct rawview_client *c = container_of(pctx->polls[i], struct rawview_client, in);
-				if (c == client)
-					continue;
-				write(c->out, &pkt, sizeof(pkt));
-			}
-		}
+	case RAWVIEW_CMD_NEW_ENTROPY:
+		newc = new_rawview_client(prg, &entropy_graph,
+					  client->input_name,
+					  pkt.input_offset,
+					  pkt.input_size);
+		if (!newc)
+			break;
+		add_poll(pctx, &newc->in);
 		break;
 	}
+	span_end(__func__, span, "\"cmd\":%d", pkt.cmd);
+}
+
+/*
+ * Headless mode: run the graph over the block at -O/-B and write the result
+ * to an image file (PNG for *.png, otherwise PPM) or, for "-", to stdout.
+ */
+static int render_to_file(struct rawview *prg, const char *output)
+{
+	struct window *view = calloc(1, sizeof(*view));
+	size_t len = strlen(output);
+	int png = len > 4 && strcasecmp(output + len - 4, ".png") == 0;
+	ssize_t rd = 0;
+	size_t covered;
+	FILE *fp;
+	int ret;
+
+	if (!view) {
+		error("out of memory");
+		return 2;
+	}
+	start_pool(prg);
+	start_input(prg);
+	view->gd = prg->graph;
+	view->pool = prg->pool;
+	view->graph_area.width = graph_width(prg, view->gd);
+	view->graph_area.height = graph_height(prg, view->gd);
+	if (fb_create(view)) {
+		error("out of memory");
+		free(view);
+		return 2;
+	}
+	if (prg->graph->setup)
+		prg->graph->setup(view, prg->in.input_size);
+	input_start_block(&prg->in);
+	prg->graph->start_block(view, prg->in.input_offset);
+	covered = load_pyramid_block(prg, view);
+	if (covered)
+		prg->in.amount = covered;
+	while (prg->in.amount < prg->in.input_size) {
+		const uint8_t *data;
+
+		rd = input_next(&prg->in, &data, prg->in.input_size - prg->in.amount);
+		if (rd < 0 && errno == EINTR)
+			continue;
+		if (rd <= 0)
+			break;
+		prg->graph->analyze(view, data, rd);
+	}
+	if (rd < 0)
+		error("read: %s", strerror(errno));
+	if (prg->graph->render)
+		prg->graph->render(view);
+
+	fp = strcmp(output, "-") ? fopen(output, "wb") : stdout;
+	if (!fp) {
+		error("%s: %s", output, strerror(errno));
+		ret = -1;
+		goto out;
+	}
+	ret = png ? write_png(&view->fb, fp) : write_ppm(&view->fb, fp);
+	if (ret)
+		error("%s: %s", output, strerror(errno));
+	if (fp != stdout)
+		fclose(fp);
+out:
+	if (prg->graph->destroy)
+		prg->graph->destroy(view);
+	fb_destroy(view);
+	free(view);
+	return ret ? 2 : 0;
+}
+
+/* -x: the statistics of every block from -O on, CSV unless FILE is .bin */
+static int sweep_to_file(struct rawview *prg, const char *output)
+{
+	size_t len = strlen(output);
+	int binary = len > 4 && strcasecmp(output + len - 4, ".bin") == 0;
+	FILE *fp;
+	int ret;
+
+	start_pool(prg);
+	if (!prg->in.map)
+		input_map(&prg->in);
+	fp = strcmp(output, "-") ? fopen(output, "wb") : stdout;
+	if (!fp) {
+		error("%s: %s", output, strerror(errno));
+		return 2;
+	}
+	ret = sweep(&prg->in, prg->pool, bytes_classes, fp, binary);
+	if (ret)
+		error("%s: %s", output, strerror(errno));
+	if (fp != stdout && fclose(fp) && !ret) {
+		error("%s: %s", output, strerror(errno));
+		ret = -1;
+	}
+	return ret ? 2 : 0;
 }
 
 static int cmd_loop(struct rawview *prg, const char *input_name)
 {
 	static struct poll_context ctx = { 0, };
-	struct rawview_client *first = new_rawview_client(prg,
-							  prg->graph,
-							  input_name,
-							  prg->in.input_offset,
-							  prg->in.input_size);
+	struct rawview_client *first;
+
+	spans_process("cmd");
+	/* the views forked from here follow each other through it */
+	prg->position = position_new();
+	if (!prg->position)
+		error("views not linked: %s", strerror(errno));
+	first = new_rawview_client(prg, prg->graph, input_name,
+				   prg->in.input_offset, prg->in.input_size);
 	if (first)
 		add_poll(&ctx, &first->in);
 	else {
@@ -1017,11 +2086,6 @@ int main(int argc, char *argv[])
 {
 	static struct rawview prg = {
 		.cmdout = -1,
-		.cmdin = {
-			.fd = -1,
-			.events = POLLIN,
-			.proc = pfd_viewcmd_proc,
-		},
 		.pfd = {
 			.events = POLLIN,
 			.proc = pfd_xcb_proc,
@@ -1039,15 +2103,22 @@ int main(int argc, char *argv[])
 		.title = RAWVIEW,
 		.autoscroll = 0,
 		.seekable = 1,
+		.cache = { .cap = (size_t)CACHE_DEFAULT_MB << 20 },
+		.spill_cap = (size_t)SPILL_DEFAULT_MB << 20,
+		.frame_ms = FRAME_MS,
 
 		.status_height = 32,
 		.graph = &conti_graph,
 	};
 	const char *input_name = "*stdin*";
+	const char *output = NULL;
+	const char *sweep_output = NULL;
+	const char *spans = getenv(SPANS_ENV);
 	struct stat fd_st;
+	sigset_t sigs;
 	int opt;
 
-	while ((opt = getopt(argc, argv, "hDO:B:Av:")) != -1)
+	while ((opt = getopt(argc, argv, "hDO:B:Av:C:o:g:M:Tj:UdF:fS:st:x:")) != -1)
 		switch (opt) {
 		case 'A':
 			prg.autoscroll = 1;
@@ -1063,13 +2134,82 @@ int main(int argc, char *argv[])
 			break;
 		case 'h':
 			break;
+		case 'o':
+			output = optarg;
+			break;
+		case 'x':
+			sweep_output = optarg;
+			break;
+		case 'g':
+			if (sscanf(optarg, "%ux%u", &prg.graph_width, &prg.graph_height) != 2 ||
+			    !prg.graph_width || !prg.graph_height ||
+			    prg.graph_width > UINT16_MAX || prg.graph_height > UINT16_MAX) {
+				error("%s: geometry is WIDTHxHEIGHT", optarg);
+				exit(2);
+			}
+			if (check_geometry(prg.graph_width, prg.graph_height))
+				exit(2);
+			break;
+		case 'T':
+			prg.threaded = 1;
+			break;
+		case 'd':
+			prg.direct = 1;
+			/* fall through */
+		case 'U':
+			prg.uring = 1;
+			break;
+		case 'f':
+			prg.follow = 1;
+			break;
+		case 's':
+			prg.stats = 1;
+			break;
+		case 't':
+			/* a new trace, detached views find it in the environment */
+			if (spans_open(optarg, 1) == -1) {
+				error("%s: %s", optarg, strerror(errno));
+				exit(2);
+			}
+			setenv(SPANS_ENV, optarg, 1);
+			spans = NULL;
+			break;
+		case 'F':
+			prg.frame_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 'j':
+			prg.jobs = strtoul(optarg, NULL, 0);
+			break;
+		case 'S':
+			prg.spill_cap = parse_mb(optarg);
+			if (prg.spill_cap && prg.spill_cap < (size_t)SPILL_MIN_MB << 20)
+				prg.spill_cap = (size_t)SPILL_MIN_MB << 20;
+			break;
+		case 'M':
+			prg.cache.cap = parse_mb(optarg);
+			break;
+		case 'C':
+			/* the built-in tables, else a file of one */
+			bytes_classes = find_byte_classes(optarg);
+			if (!bytes_classes)
+				bytes_classes = load_byte_classes(optarg);
+			if (!bytes_classes) {
+				error("%s: %s", optarg, errno == ENOENT ? "unknown byte classes" :
+				      errno == EINVAL ? "not 256 palette indices" : strerror(errno));
+				exit(2);
+			}
+			break;
 		case 'v':
 			if (strcasecmp(optarg, conti_graph.name) == 0)
 				prg.graph = &conti_graph;
 			else if (strcasecmp(optarg, bytes_graph.name) == 0)
 				prg.graph = &bytes_graph;
+			else if (strcasecmp(optarg, entropy_graph.name) == 0)
+				prg.graph = &entropy_graph;
 			break;
 		}
+	if (spans && spans_open(spans, 0) == -1)
+		error("%s: %s", spans, strerror(errno));
 	if (optind < argc) {
 		int fd = open(argv[optind], O_RDONLY);
 
@@ -1097,6 +2237,11 @@ int main(int argc, char *argv[])
 		if (!prg.in.input_size)
 			prg.in.input_size = DEFAULT_INPUT_BLOCK_SIZE;
 	}
+	/* -U: the views set their rings up */
+	if (!prg.uring)
+		input_map(&prg.in);
+	if (lseek(prg.in.pfd.fd, 0, SEEK_CUR) == -1)
+		prg.seekable = 0;
 	if (prg.in.input_offset &&
 	    prg.seekable &&
 	    lseek(prg.in.pfd.fd, prg.in.input_offset, SEEK_SET) == -1) {
@@ -1104,9 +2249,20 @@ int main(int argc, char *argv[])
 		prg.seekable = 0;
 		error("seek in %s: %s", input_name, strerror(errno));
 	}
+	if (output)
+		return render_to_file(&prg, output);
+	if (sweep_output)
+		return sweep_to_file(&prg, sweep_output);
+	start_spill(&prg);
 	signal(SIGCHLD, SIG_IGN); /* autorip child processes */
+	/* before any thread, pfd_dump_proc() takes it from a signalfd */
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGUSR1);
+	sigprocmask(SIG_BLOCK, &sigs, NULL);
 	prg.argc = argc;
 	prg.argv = argv;
 
+	if (prg.threaded)
+		return view_loop(&prg, input_name);
 	return cmd_loop(&prg, input_name);
 }
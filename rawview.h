@@ -2,9 +2,11 @@
 #define _RAWVIEW_H_
 
 #include <stdint.h>
+#include <stdlib.h>
 #include <xcb/xcb.h>
 #include <xcb/xcb_atom.h>
 #include "poll-fds.h"
+#include "fb.h"
 
 struct window
 {
@@ -24,13 +26,24 @@ struct window
 		uint32_t white;
 		uint32_t black;
 		uint32_t border;
-		uint32_t graph_fg[10];
+		uint32_t graph_fg[GRAPH_FG_COLORS];
 		uint32_t graph_bg;
 	} colors;
 	unsigned int font_height, font_base;
 	xcb_rectangle_t status_area;
 	char status_line1[100];
 	char status_line2[100];
+	struct framebuffer fb;
+	/* worker threads the graph may split large buffers over, or NULL */
+	struct pool *pool;
+
+	/* the graph drawn in the window and its per-window state */
+	struct graph_desc *gd;
+	void *priv;
+	struct window *next;
+	unsigned loaded:1; /* the block is complete without reading it */
+	unsigned cached:1; /* showing a cached block, not the analysis */
+	unsigned resized:1; /* to be laid out again once the size settled */
 };
 
 struct well_known_atom
@@ -40,18 +53,32 @@ struct well_known_atom
 };
 extern struct well_known_atom ATOM;
 
+struct byte_classes;
+struct pool;
+
 struct graph_desc
 {
 	const char *name;
 	unsigned int width, height;
+	/* the smallest -g it lays out, 0 for any */
+	unsigned int min_width, min_height;
 
 	void (*start_block)(struct window *, off_t offset);
 	void (*setup)(struct window *, size_t blk);
-	void (*analyze)(struct window *, uint8_t buf[], size_t count);
+	void (*analyze)(struct window *, const uint8_t buf[], size_t count);
+	void (*render)(struct window *);
+	/* draw what was analyzed of the block again after setup(), 0 if it cannot */
+	int (*redraw)(struct window *);
+	/* the bigrams of the block up to last, its last byte, analyze() goes on */
+	void (*add_bigrams)(struct window *, const uint32_t hist[], uint8_t last);
+	/* frees the state setup() allocated in priv */
+	void (*destroy)(struct window *);
 };
 
 extern struct graph_desc conti_graph;
 extern struct graph_desc bytes_graph;
+extern struct graph_desc entropy_graph;
+extern const struct byte_classes *bytes_classes;
 
 extern char RAWVIEW[];
 
@@ -61,4 +88,14 @@ extern int trace_if(int level, const char *fmt, ...);
 #define error(fmt, ...) printf_error("%s: " fmt "\n", RAWVIEW, ## __VA_ARGS__)
 extern int printf_error(const char *fmt, ...);
 
+/* the graph state of the window, allocated zeroed on first use */
+static inline void *graph_priv(struct window *view, size_t size)
+{
+	if (!view->priv && !(view->priv = calloc(1, size))) {
+		error("out of memory");
+		exit(2);
+	}
+	return view->priv;
+}
+
 #endif /* _RAWVIEW_H_ */
@@ -0,0 +1,107 @@
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include "rawview.h"
+#include "stats.h"
+#include "spans.h"
+
+/* the longest event, longer ones are dropped */
+#define SPAN_EVENT (512)
+
+static int spans_fd = -1;
+
+int spans_open(const char *path, int truncate)
+{
+	int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC |
+		      (truncate ? O_TRUNC : 0), 0644);
+	off_t end;
+
+	if (fd == -1)
+		return -1;
+	/* the array is left open, so that every view can add to it */
+	end = lseek(fd, 0, SEEK_END);
+	if (end == 0)
+		write(fd, "[\n", 2);
+	spans_fd = fd;
+	return 0;
+}
+
+/* not cached, a forked view would go on with its parent's */
+static long tid(void)
+{
+	return syscall(SYS_gettid);
+}
+
+static void emit(const char *fmt, ...)
+{
+	char event[SPAN_EVENT];
+	va_list args;
+	int len;
+
+	va_start(args, fmt);
+	len = vsnprintf(event, sizeof(event), fmt, args);
+	va_end(args);
+	if (len < 0)
+		return;
+	if (len >= (int)sizeof(event)) {
+		trace("%s: event too long\n", __func__);
+		return;
+	}
+	write(spans_fd, event, len);
+}
+
+void spans_process(const char *name)
+{
+	if (spans_fd == -1)
+		return;
+	emit("{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%ld,\"tid\":%ld,"
+	     "\"args\":{\"name\":\"%s %s\"}},\n",
+	     (long)getpid(), tid(), RAWVIEW, name);
+}
+
+uint64_t span_begin(void)
+{
+	return spans_fd == -1 ? 0 : stats_now();
+}
+
+void span_end(const char *name, uint64_t start, const char *fmt, ...)
+{
+	char args[SPAN_EVENT / 2] = "";
+	uint64_t now;
+
+	if (spans_fd == -1 || !start)
+		return;
+	now = stats_now();
+	if (fmt) {
+		va_list ap;
+
+		va_start(ap, fmt);
+		vsnprintf(args, sizeof(args), fmt, ap);
+		va_end(ap);
+	}
+	emit("{\"ph\":\"X\",\"name\":\"%s\",\"pid\":%ld,\"tid\":%ld,"
+	     "\"ts\":%.3f,\"dur\":%.3f,\"args\":{%s}},\n",
+	     name, (long)getpid(), tid(),
+	     start / 1e3, (now - start) / 1e3, args);
+}
+
+void span_flow(const char *cat, uint64_t id, char ph)
+{
+	if (spans_fd == -1)
+		return;
+	/* bound to the span around it, not to the next one */
+	emit("{\"ph\":\"%c\",\"bp\":\"e\",\"name\":\"%s\",\"cat\":\"%s\",\"id\":%llu,"
+	     "\"pid\":%ld,\"tid\":%ld,\"ts\":%.3f},\n",
+	     ph, cat, cat, (unsigned long long)id,
+	     (long)getpid(), tid(), stats_now() / 1e3);
+}
+
+uint64_t span_flow_id(void)
+{
+	static uint64_t n;
+
+	return (uint64_t)getpid() << 32 | ++n;
+}
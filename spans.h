@@ -0,0 +1,32 @@
+#ifndef _SPANS_H_
+#define _SPANS_H_ 1
+
+#include <stdint.h>
+
+/*
+ * Spans of the processes and threads in one file, as Chrome trace events
+ * which Perfetto and chrome://tracing open. Every event is one write()
+ * to a file opened O_APPEND, all views add to it on the same clock.
+ * -t starts the file, views started with SPANS_ENV set add to it.
+ */
+#define SPANS_ENV "RAWVIEW_SPANS"
+
+int spans_open(const char *path, int truncate);
+/* names the process in the trace */
+void spans_process(const char *name);
+
+/* the start of a span, 0 if not tracing */
+uint64_t span_begin(void);
+/* a span from start until now, fmt the members of its args object or NULL */
+void span_end(const char *name, uint64_t start, const char *fmt, ...)
+	__attribute__((format(printf, 3, 4)));
+/*
+ * Arrows from the span being recorded to others, in any process: 's' starts
+ * id in the sender, 'f' finishes it in the one receiver, or 't' steps on
+ * in each of many.
+ */
+void span_flow(const char *cat, uint64_t id, char ph);
+/* an id for a flow of this process */
+uint64_t span_flow_id(void);
+
+#endif /* _SPANS_H_ */
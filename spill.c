@@ -0,0 +1,160 @@
+#define _GNU_SOURCE /* O_TMPFILE */
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "rawview.h"
+#include "spill.h"
+#include "stats.h"
+
+/* the file grows in these steps until it is cap bytes */
+#define SPILL_GROW (4 * 1024 * 1024)
+/* read from the pipe at once at most */
+#define SPILL_READ (1024 * 1024)
+
+/* in memory shared by all views */
+struct spill
+{
+	pthread_mutex_t lock; /* held while reading the pipe */
+	uint8_t *ring;
+	size_t cap;
+	int fd;
+	off_t size; /* of the file */
+	off_t end; /* bytes of the input read into the ring */
+	off_t filling; /* end the read in progress may reach, else end */
+	int eof;
+};
+
+static int open_tmpfile(void)
+{
+	const char *dir = getenv("TMPDIR");
+	char path[4096];
+	int fd;
+
+	if (!dir || !*dir)
+		dir = "/tmp";
+	fd = open(dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+	if (fd != -1 || (errno != EOPNOTSUPP && errno != EISDIR && errno != EINVAL))
+		return fd;
+	snprintf(path, sizeof(path), "%s/rawview-XXXXXX", dir);
+	fd = mkostemp(path, O_CLOEXEC);
+	if (fd != -1)
+		unlink(path);
+	return fd;
+}
+
+struct spill *spill_new(size_t cap)
+{
+	pthread_mutexattr_t attr;
+	struct spill *s = mmap(NULL, sizeof(*s), PROT_READ | PROT_WRITE,
+			       MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+	if (s == MAP_FAILED)
+		return NULL;
+	s->cap = cap;
+	s->fd = open_tmpfile();
+	if (s->fd == -1)
+		goto fail;
+	/* the file grows into the mapping, which does not move */
+	s->ring = mmap(NULL, cap, PROT_READ | PROT_WRITE, MAP_SHARED, s->fd, 0);
+	if (s->ring == MAP_FAILED)
+		goto fail_fd;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+	pthread_mutex_init(&s->lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+	trace("%s: %zu bytes\n", __func__, cap);
+	return s;
+fail_fd:
+	close(s->fd);
+fail:
+	trace("%s: %s\n", __func__, strerror(errno));
+	munmap(s, sizeof(*s));
+	return NULL;
+}
+
+off_t spill_first(const struct spill *s)
+{
+	off_t end;
+
+	/* after the data the caller looked at, it may be overwritten since */
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	end = __atomic_load_n(&s->filling, __ATOMIC_ACQUIRE);
+	return end > (off_t)s->cap ? end - (off_t)s->cap : 0;
+}
+
+/* append to the ring what the pipe has, under the lock */
+static ssize_t fill(struct spill *s, int fd)
+{
+	size_t at = s->end % s->cap;
+	size_t count = s->cap - at;
+	ssize_t rd;
+
+	if (count > SPILL_READ)
+		count = SPILL_READ;
+	if (s->size < (off_t)s->cap && (off_t)(at + count) > s->size) {
+		off_t size = (at + count + SPILL_GROW - 1) / SPILL_GROW * SPILL_GROW;
+
+		if (size > (off_t)s->cap)
+			size = s->cap;
+		if (ftruncate(s->fd, size) == -1)
+			return -1;
+		s->size = size;
+	}
+	/* the oldest bytes are given up before read() overwrites them */
+	__atomic_store_n(&s->filling, s->end + count, __ATOMIC_SEQ_CST);
+	rd = read(fd, s->ring + at, count);
+	stats_add(STAT_READS, 1);
+	if (rd > 0)
+		__atomic_store_n(&s->end, s->end + rd, __ATOMIC_RELEASE);
+	else if (!rd)
+		__atomic_store_n(&s->eof, 1, __ATOMIC_RELEASE);
+	/* a short read gives back what it did not overwrite */
+	__atomic_store_n(&s->filling, s->end, __ATOMIC_RELEASE);
+	return rd;
+}
+
+ssize_t spill_read(struct spill *s, int fd, off_t pos, const uint8_t **data, size_t count)
+{
+	off_t end;
+	size_t at;
+	int ret;
+
+	if (pos < spill_first(s)) {
+		errno = ESPIPE;
+		return -1;
+	}
+	/* read the pipe up to pos, unless another view is at it */
+	while (pos >= (end = __atomic_load_n(&s->end, __ATOMIC_ACQUIRE))) {
+		ssize_t rd;
+
+		if (__atomic_load_n(&s->eof, __ATOMIC_ACQUIRE))
+			return 0;
+		ret = pthread_mutex_trylock(&s->lock);
+		if (ret == EOWNERDEAD)
+			pthread_mutex_consistent(&s->lock);
+		else if (ret) {
+			errno = EAGAIN;
+			return -1;
+		}
+		rd = s->eof ? 0 : fill(s, fd);
+		pthread_mutex_unlock(&s->lock);
+		if (rd < 0)
+			return -1;
+		if (!rd)
+			return 0;
+	}
+	at = pos % s->cap;
+	if (count > (size_t)(end - pos))
+		count = end - pos;
+	if (count > s->cap - at)
+		count = s->cap - at;
+	*data = s->ring + at;
+	return count;
+}
@@ -0,0 +1,31 @@
+#ifndef _SPILL_H_
+#define _SPILL_H_ 1
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* default bytes of a pipe kept for going back, -S */
+#define SPILL_DEFAULT_MB (1024)
+#define SPILL_MIN_MB (64)
+
+/*
+ * What was read of a non-seekable input, kept in an unlinked temporary
+ * file mapped as a ring of cap bytes. The pipe is read straight into the
+ * mapping and the graphs get pointers into it, the last cap bytes of the
+ * input can be read again. Set up before fork(), the views share it: the
+ * one which needs data past the end reads the pipe, the others find it in
+ * the ring.
+ */
+struct spill;
+
+struct spill *spill_new(size_t cap);
+/* the data at pos, at most count bytes, or -1 with EAGAIN if none yet */
+ssize_t spill_read(struct spill *, int fd, off_t pos, const uint8_t **data, size_t count);
+/*
+ * The first offset still kept. Another view may refill the ring under data
+ * spill_read() returned, it is intact only if still at or after this.
+ */
+off_t spill_first(const struct spill *);
+
+#endif /* _SPILL_H_ */
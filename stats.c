@@ -0,0 +1,79 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include "rawview.h"
+#include "stats.h"
+
+uint64_t stats[STAT_COUNT];
+
+static const char *const names[STAT_COUNT] = {
+	[STAT_READ_BYTES] = "read bytes",
+	[STAT_READS] = "read calls",
+	[STAT_ANALYZE_NS] = "analyze ns",
+	[STAT_X_REQUESTS] = "X requests",
+	[STAT_GC_CHANGES] = "GC changes",
+	[STAT_FLUSHES] = "X flushes",
+	[STAT_FRAMES] = "frames",
+	[STAT_FRAME_NS] = "frame ns",
+	[STAT_FRAME_MAX_NS] = "frame max ns",
+};
+
+uint64_t stats_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t get(enum stat_counter s)
+{
+	return __atomic_load_n(&stats[s], __ATOMIC_RELAXED);
+}
+
+void stats_max(enum stat_counter s, uint64_t n)
+{
+	uint64_t old = get(s);
+
+	while (n > old &&
+	       !__atomic_compare_exchange_n(&stats[s], &old, n, 1,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+/* requests are numbered on the connection, the event loop is its only user */
+void stats_x_sequence(unsigned sequence)
+{
+	static unsigned last;
+
+	if ((int)(sequence - last) > 0) {
+		stats_add(STAT_X_REQUESTS, sequence - last);
+		last = sequence;
+	}
+}
+
+void stats_format(char *buf, size_t size)
+{
+	uint64_t frames = get(STAT_FRAMES);
+
+	snprintf(buf, size, "rd %lluM/%llu an %llums x %llu gc %llu fl %llu fr %llu %.1f/%.1fms",
+		 (unsigned long long)(get(STAT_READ_BYTES) >> 20),
+		 (unsigned long long)get(STAT_READS),
+		 (unsigned long long)(get(STAT_ANALYZE_NS) / 1000000),
+		 (unsigned long long)get(STAT_X_REQUESTS),
+		 (unsigned long long)get(STAT_GC_CHANGES),
+		 (unsigned long long)get(STAT_FLUSHES),
+		 (unsigned long long)frames,
+		 frames ? get(STAT_FRAME_NS) / 1e6 / frames : 0.0,
+		 get(STAT_FRAME_MAX_NS) / 1e6);
+}
+
+void stats_dump(void)
+{
+	unsigned i;
+
+	for (i = 0; i < STAT_COUNT; ++i)
+		fprintf(stderr, "%s[%ld]: %-12s %llu\n", RAWVIEW, (long)getpid(),
+			names[i], (unsigned long long)get(i));
+}
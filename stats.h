@@ -0,0 +1,43 @@
+#ifndef _STATS_H_
+#define _STATS_H_ 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Counters of the process, bumped with relaxed atomics from whichever
+ * thread gets there: the pipeline's, the pool's, or the event loop.
+ * Times are in nanoseconds of the monotonic clock.
+ */
+enum stat_counter
+{
+	STAT_READ_BYTES, /* handed to the graphs by input_next() */
+	STAT_READS, /* read() and io_uring_enter() calls */
+	STAT_ANALYZE_NS,
+	STAT_X_REQUESTS,
+	STAT_GC_CHANGES,
+	STAT_FLUSHES,
+	STAT_FRAMES,
+	STAT_FRAME_NS, /* drawing them, render to flush */
+	STAT_FRAME_MAX_NS,
+	STAT_COUNT
+};
+
+uint64_t stats_now(void);
+
+static inline void stats_add(enum stat_counter s, uint64_t n)
+{
+	extern uint64_t stats[STAT_COUNT];
+
+	__atomic_fetch_add(&stats[s], n, __ATOMIC_RELAXED);
+}
+
+void stats_max(enum stat_counter, uint64_t);
+/* the X requests up to and including the one of this sequence number */
+void stats_x_sequence(unsigned sequence);
+/* one short line, for the status area */
+void stats_format(char *buf, size_t size);
+/* all of them on stderr, with the pid */
+void stats_dump(void);
+
+#endif /* _STATS_H_ */
@@ -0,0 +1,348 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <endian.h>
+#include <math.h>
+#include <sys/mman.h>
+#include "rawview.h"
+#include "input.h"
+#include "hist.h"
+#include "classify.h"
+#include "pool.h"
+#include "sweep.h"
+
+/* blocks of a batch per thread, and what is read into memory for one at most */
+#define SWEEP_BLOCKS (16)
+#define SWEEP_BATCH (64 * 1024 * 1024)
+/* c * log2(c) is looked up below this, most pairs of a block are rare */
+#define SWEEP_CLOGC (4096)
+/* room for a CSV line, all 256 counts of 10 digits at most */
+#define SWEEP_LINE (4096)
+
+struct sweep_job
+{
+	const uint8_t *data; /* the batch, block after block */
+	size_t len;
+	off_t offset;
+	size_t size;
+	const struct byte_classes *classes;
+	struct pool *pool;
+	struct sweep_record *rec;
+	/* CSV lines formatted on the threads too, SWEEP_LINE bytes each */
+	char *lines;
+	size_t *line_len;
+};
+
+static double clogc_table[SWEEP_CLOGC];
+
+static void make_table(void)
+{
+	unsigned n;
+
+	for (n = 1; n < SWEEP_CLOGC; ++n)
+		clogc_table[n] = n * log2(n);
+}
+
+static double clogc(uint32_t n)
+{
+	return n < SWEEP_CLOGC ? clogc_table[n] : n * log2(n);
+}
+
+static uint64_t rotl(uint64_t x, unsigned r)
+{
+	return x << r | x >> (64 - r);
+}
+
+/* MurmurHash3's mixing over little-endian words */
+static uint64_t block_hash(const uint8_t buf[], size_t count)
+{
+	const uint64_t c1 = 0x87c37b91114253d5ull, c2 = 0x4cf5ad432745937full;
+	uint64_t h = 0, k;
+	size_t i;
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		memcpy(&k, buf + i, sizeof(k));
+		h ^= rotl(le64toh(k) * c1, 31) * c2;
+		h = rotl(h, 27) * 5 + 0x52dce729;
+	}
+	for (k = 0; i < count; ++i)
+		k |= (uint64_t)buf[i] << 8 * (i & 7);
+	h ^= rotl(k * c1, 31) * c2;
+	h ^= count;
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ull;
+	h ^= h >> 33;
+	return h;
+}
+
+/* four tables, runs of one byte value are not a chain of increments */
+static void byte_hist(uint32_t hist[256], const uint8_t buf[], size_t count)
+{
+	uint32_t sub[3][256] = { { 0 } };
+	size_t i;
+	unsigned b;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		hist[buf[i]]++;
+		sub[0][buf[i + 1]]++;
+		sub[1][buf[i + 2]]++;
+		sub[2][buf[i + 3]]++;
+	}
+	for (; i < count; ++i)
+		hist[buf[i]]++;
+	for (b = 0; b < 256; ++b)
+		hist[b] += sub[0][b] + sub[1][b] + sub[2][b];
+}
+
+static void add_pair(struct sweep_record *rec, unsigned pair, uint32_t n, double *sum)
+{
+	rec->bigrams++;
+	*sum += clogc(n);
+	if (n > rec->top_count || (n == rec->top_count && pair < rec->top_bigram)) {
+		rec->top_count = n;
+		rec->top_bigram = pair;
+	}
+}
+
+/*
+ * The pairs are counted into a table of the thread. A small block takes
+ * its distinct pairs out of it by going over the block again, a large one
+ * goes over the table; either way it is left cleared.
+ */
+static void bigram_summary(struct sweep_record *rec, struct pool *pool,
+			   const uint8_t buf[], size_t count)
+{
+	static __thread uint32_t *pairs;
+	double sum = 0;
+	size_t i;
+
+	if (count < 2)
+		return;
+	if (!pairs && !(pairs = calloc(BIGRAMS, sizeof(*pairs)))) {
+		error("out of memory");
+		exit(2);
+	}
+	bigram_count_pool(pool, pairs, buf, count);
+	if (count - 1 < BIGRAMS) {
+		for (i = 1; i < count; ++i) {
+			unsigned pair = BIGRAM(buf[i - 1], buf[i]);
+
+			if (!pairs[pair])
+				continue;
+			add_pair(rec, pair, pairs[pair], &sum);
+			pairs[pair] = 0;
+		}
+	} else {
+		for (i = 0; i < BIGRAMS; ++i)
+			if (pairs[i])
+				add_pair(rec, i, pairs[i], &sum);
+		memset(pairs, 0, BIGRAMS * sizeof(*pairs));
+	}
+	rec->bigram_entropy = log2(count - 1) - sum / (count - 1);
+}
+
+/* ",n" at p, the counts are most of a line and printf() is slow at them */
+static char *put_count(char *p, uint32_t n)
+{
+	char digits[10];
+	unsigned len = 0;
+
+	do
+		digits[len++] = '0' + n % 10;
+	while (n /= 10);
+	*p++ = ',';
+	while (len)
+		*p++ = digits[--len];
+	return p;
+}
+
+static size_t format_csv(char *line, const struct sweep_record *rec)
+{
+	char *p = line;
+	unsigned i;
+
+	p += snprintf(p, SWEEP_LINE, "%llu,%llu,%016llx,%.4f,%u,%04x,%u,%.4f",
+		      (unsigned long long)rec->offset, (unsigned long long)rec->size,
+		      (unsigned long long)rec->hash, rec->entropy, rec->bigrams,
+		      rec->top_bigram, rec->top_count, rec->bigram_entropy);
+	for (i = 0; i < GRAPH_COLORS; ++i)
+		p += sprintf(p, ",%.4f", rec->classes[i]);
+	for (i = 0; i < 256; ++i)
+		p = put_count(p, rec->hist[i]);
+	*p++ = '\n';
+	return p - line;
+}
+
+static void sweep_block(void *arg, unsigned i)
+{
+	const struct sweep_job *job = arg;
+	struct sweep_record *rec = &job->rec[i];
+	const uint8_t *buf = job->data + (size_t)i * job->size;
+	size_t count = job->len - (size_t)i * job->size;
+	uint64_t classes[GRAPH_COLORS] = { 0 };
+	double sum = 0;
+	unsigned b;
+
+	if (count > job->size)
+		count = job->size;
+	memset(rec, 0, sizeof(*rec));
+	rec->offset = job->offset + (off_t)i * job->size;
+	rec->size = count;
+	rec->hash = block_hash(buf, count);
+	byte_hist(rec->hist, buf, count);
+	for (b = 0; b < 256; ++b) {
+		uint32_t n = rec->hist[b];
+
+		sum += clogc(n);
+		classes[job->classes->cls[b]] += n;
+	}
+	rec->entropy = log2(count) - sum / count;
+	for (b = 0; b < GRAPH_COLORS; ++b)
+		rec->classes[b] = (double)classes[b] / count;
+	bigram_summary(rec, job->pool, buf, count);
+	if (job->lines)
+		job->line_len[i] = format_csv(job->lines + (size_t)i * SWEEP_LINE, rec);
+}
+
+/* as much as there is up to len, short only at the end of the input */
+static ssize_t read_batch(int fd, uint8_t *buf, size_t len)
+{
+	size_t got = 0;
+
+	while (got < len) {
+		ssize_t rd = read(fd, buf + got, len - got);
+
+		if (rd == -1 && errno == EINTR)
+			continue;
+		if (rd == -1)
+			return -1;
+		if (!rd)
+			break;
+		got += rd;
+	}
+	return got;
+}
+
+/* a pipe cannot seek to -O, what comes before it is read and dropped */
+static int skip_to(int fd, off_t offset, uint8_t *buf, size_t len)
+{
+	if (lseek(fd, 0, SEEK_CUR) != -1) /* main() seeked */
+		return 0;
+	while (offset > 0) {
+		ssize_t rd = read_batch(fd, buf, offset < (off_t)len ? (size_t)offset : len);
+
+		if (rd == -1)
+			return -1;
+		if (!rd)
+			break;
+		offset -= rd;
+	}
+	return 0;
+}
+
+static void write_csv_header(FILE *out)
+{
+	unsigned i;
+
+	fputs("offset,size,hash,entropy,bigrams,top_bigram,top_count,bigram_entropy", out);
+	for (i = 0; i < GRAPH_COLORS; ++i)
+		fprintf(out, ",class%u", i);
+	for (i = 0; i < 256; ++i)
+		fprintf(out, ",byte%02x", i);
+	fputc('\n', out);
+}
+
+
+/*
+ * Mapped input is swept where it is, everything else is read a batch at
+ * a time into a buffer. A batch of one block leaves the pool to counting
+ * its pairs.
+ */
+int sweep(struct input *in, struct pool *pool, const struct byte_classes *classes,
+	  FILE *out, int binary)
+{
+	struct sweep_job job = {
+		.offset = in->input_offset,
+		.size = in->input_size,
+		.classes = classes,
+		.pool = pool,
+	};
+	size_t blocks = (size_t)pool_threads(pool) * SWEEP_BLOCKS;
+	uint8_t *buf = NULL;
+	unsigned i, n;
+	int ret = -1;
+
+	/* the counts are 32 bits */
+	if (!job.size || job.size > UINT32_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (blocks > SWEEP_BATCH / job.size)
+		blocks = SWEEP_BATCH / job.size ? SWEEP_BATCH / job.size : 1;
+	job.rec = calloc(blocks, sizeof(*job.rec));
+	if (!job.rec)
+		return -1;
+	if (!binary) {
+		job.lines = malloc(blocks * SWEEP_LINE);
+		job.line_len = calloc(blocks, sizeof(*job.line_len));
+		if (!job.lines || !job.line_len)
+			goto out;
+	}
+	make_table();
+	if (in->map && job.offset < in->map_size) {
+		off_t start = job.offset & ~(off_t)(sysconf(_SC_PAGESIZE) - 1);
+
+		madvise((void *)(in->map + start), in->map_size - start, MADV_SEQUENTIAL);
+	} else if (!in->map && !(buf = malloc(blocks * job.size)))
+		goto out;
+	if (!in->map && skip_to(in->pfd.fd, job.offset, buf, blocks * job.size) == -1)
+		goto out;
+	if (!binary)
+		write_csv_header(out);
+	for (;;) {
+		if (in->map) {
+			if (job.offset >= in->map_size)
+				break;
+			job.data = in->map + job.offset;
+			job.len = in->map_size - job.offset;
+			if (job.len > blocks * job.size)
+				job.len = blocks * job.size;
+		} else {
+			ssize_t rd = read_batch(in->pfd.fd, buf, blocks * job.size);
+
+			if (rd == -1)
+				goto out;
+			if (!rd)
+				break;
+			job.data = buf;
+			job.len = rd;
+		}
+		n = (job.len + job.size - 1) / job.size;
+		if (n == 1)
+			sweep_block(&job, 0);
+		else
+			pool_run(pool, n, sweep_block, &job);
+		for (i = 0; i < n; ++i)
+			if (binary)
+				fwrite(&job.rec[i], sizeof(job.rec[i]), 1, out);
+			else
+				fwrite(job.lines + (size_t)i * SWEEP_LINE, job.line_len[i], 1, out);
+		if (ferror(out))
+			goto out;
+		job.offset += job.len;
+		if (job.len < blocks * job.size && !in->map)
+			break;
+	}
+	ret = fflush(out) ? -1 : 0;
+out:
+	free(buf);
+	free(job.lines);
+	free(job.line_len);
+	free(job.rec);
+	return ret;
+}
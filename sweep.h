@@ -0,0 +1,37 @@
+#ifndef _SWEEP_H_
+#define _SWEEP_H_ 1
+
+#include <stdio.h>
+#include <stdint.h>
+#include "fb.h"
+
+/*
+ * The statistics of every block of the input from its offset on, without
+ * a window: the blocks are analyzed in batches over the threads of the
+ * pool and written in order, one record each. The binary format is the
+ * record as it is, in host byte order.
+ */
+struct sweep_record
+{
+	uint64_t offset;
+	uint64_t size;
+	uint64_t hash; /* of the bytes, the same on any host */
+	float entropy; /* bits per byte */
+	float bigram_entropy; /* bits per pair */
+	uint32_t bigrams; /* distinct pairs */
+	uint32_t top_count;
+	uint16_t top_bigram; /* BIGRAM() of the most frequent pair */
+	uint16_t reserved;
+	float classes[GRAPH_COLORS]; /* fraction of the bytes per palette index */
+	uint32_t hist[256];
+};
+
+struct input;
+struct pool;
+struct byte_classes;
+
+/* returns -1 with errno if the input or out failed */
+int sweep(struct input *, struct pool *, const struct byte_classes *,
+	  FILE *out, int binary);
+
+#endif /* _SWEEP_H_ */
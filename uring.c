@@ -0,0 +1,395 @@
+#define _GNU_SOURCE /* O_DIRECT */
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include "rawview.h"
+#include "uring.h"
+#include "stats.h"
+
+struct uring_slot
+{
+	uint8_t *buf;
+	struct iovec iov;
+	off_t off;
+	ssize_t len;
+	unsigned busy:1;  /* read in flight */
+	unsigned done:1;  /* len bytes at off, or -errno */
+	unsigned stale:1; /* in flight but no longer wanted */
+};
+
+struct uring
+{
+	int ring_fd, fd;
+	unsigned direct:1;
+
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	struct io_uring_sqe *sqes;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+	unsigned to_submit;
+
+	struct uring_slot slot[URING_SLOTS];
+	struct uring_slot *current; /* handed out by uring_next() */
+	/* the chunks of the range start at base, queued is the next to read */
+	off_t base, end, queued;
+	off_t ahead, ahead_end;
+};
+
+static int io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int map_rings(struct uring *r, const struct io_uring_params *p)
+{
+	size_t sq_size = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+	size_t cq_size = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+	uint8_t *sq, *cq;
+
+	if (p->features & IORING_FEAT_SINGLE_MMAP) {
+		if (cq_size > sq_size)
+			sq_size = cq_size;
+		cq_size = sq_size;
+	}
+	sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		  r->ring_fd, IORING_OFF_SQ_RING);
+	if (sq == MAP_FAILED)
+		return -1;
+	cq = sq;
+	if (!(p->features & IORING_FEAT_SINGLE_MMAP)) {
+		cq = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			  r->ring_fd, IORING_OFF_CQ_RING);
+		if (cq == MAP_FAILED)
+			return -1;
+	}
+	r->sqes = mmap(NULL, p->sq_entries * sizeof(struct io_uring_sqe),
+		       PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		       r->ring_fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED)
+		return -1;
+	r->sq_head = (unsigned *)(sq + p->sq_off.head);
+	r->sq_tail = (unsigned *)(sq + p->sq_off.tail);
+	r->sq_mask = (unsigned *)(sq + p->sq_off.ring_mask);
+	r->sq_array = (unsigned *)(sq + p->sq_off.array);
+	r->cq_head = (unsigned *)(cq + p->cq_off.head);
+	r->cq_tail = (unsigned *)(cq + p->cq_off.tail);
+	r->cq_mask = (unsigned *)(cq + p->cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)(cq + p->cq_off.cqes);
+	return 0;
+}
+
+/*
+ * O_DIRECT wants its own open file, the flag would otherwise change the
+ * reads of everyone sharing fd. Without it the reads at their offsets
+ * can share it.
+ */
+static void open_file(struct uring *r, int fd, int direct)
+{
+	char path[32];
+
+	r->fd = fd;
+	if (!direct)
+		return;
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+	r->fd = open(path, O_RDONLY | O_CLOEXEC | O_DIRECT);
+	if (r->fd == -1) {
+		trace("%s: O_DIRECT: %s\n", __func__, strerror(errno));
+		r->fd = fd;
+		return;
+	}
+	r->direct = 1;
+}
+
+struct uring *uring_new(int fd, int direct)
+{
+	struct io_uring_params p;
+	struct uring *r = calloc(1, sizeof(*r));
+	unsigned i;
+
+	if (!r)
+		return NULL;
+	memset(&p, 0, sizeof(p));
+	r->ring_fd = io_uring_setup(URING_SLOTS, &p);
+	if (r->ring_fd == -1) {
+		trace("%s: %s\n", __func__, strerror(errno));
+		free(r);
+		return NULL;
+	}
+	if (map_rings(r, &p) == -1)
+		goto fail;
+	for (i = 0; i < URING_SLOTS; ++i) {
+		r->slot[i].buf = aligned_alloc(URING_ALIGN, URING_CHUNK);
+		if (!r->slot[i].buf)
+			goto fail;
+	}
+	open_file(r, fd, direct);
+	trace("%s: %u slots of %u bytes%s\n", __func__, URING_SLOTS, URING_CHUNK,
+	      r->direct ? ", O_DIRECT" : "");
+	return r;
+fail:
+	/* the mappings go with the process, nothing was submitted */
+	trace("%s: %s\n", __func__, strerror(errno));
+	close(r->ring_fd);
+	for (i = 0; i < URING_SLOTS; ++i)
+		free(r->slot[i].buf);
+	free(r);
+	return NULL;
+}
+
+static void queue_read(struct uring *r, struct uring_slot *s, off_t off)
+{
+	unsigned tail = *r->sq_tail, idx = tail & *r->sq_mask;
+	struct io_uring_sqe *sqe = &r->sqes[idx];
+
+	s->off = off;
+	s->busy = 1;
+	s->done = 0;
+	s->iov.iov_base = s->buf;
+	s->iov.iov_len = URING_CHUNK;
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_READV;
+	sqe->fd = r->fd;
+	sqe->off = off;
+	sqe->addr = (uintptr_t)&s->iov;
+	sqe->len = 1;
+	sqe->user_data = s - r->slot;
+	r->sq_array[idx] = idx;
+	__atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	r->to_submit++;
+}
+
+/*
+ * Submit what was queued, and wait for a completion if asked to. Returns
+ * -1 with errno if the ring refused, what was not submitted stays queued.
+ */
+static int submit(struct uring *r, int wait)
+{
+	int ret;
+
+	if (!r->to_submit && !wait)
+		return 0;
+	do {
+		ret = io_uring_enter(r->ring_fd, r->to_submit, wait,
+				     wait ? IORING_ENTER_GETEVENTS : 0);
+		stats_add(STAT_READS, 1);
+	} while (ret == -1 && errno == EINTR);
+	if (ret == -1) {
+		trace("%s: %s\n", __func__, strerror(errno));
+		return -1;
+	}
+	r->to_submit -= ret;
+	return 0;
+}
+
+/* a file system without O_DIRECT support says so on the first read */
+static void buffered(struct uring *r)
+{
+	int flags = fcntl(r->fd, F_GETFL);
+
+	trace("%s: O_DIRECT reads fail, reading buffered\n", __func__);
+	r->direct = 0;
+	if (flags != -1)
+		fcntl(r->fd, F_SETFL, flags & ~O_DIRECT);
+}
+
+static void reap(struct uring *r)
+{
+	unsigned head = *r->cq_head;
+
+	while (head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+		const struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+		struct uring_slot *s = &r->slot[cqe->user_data];
+		int res = cqe->res;
+
+		__atomic_store_n(r->cq_head, ++head, __ATOMIC_RELEASE);
+		s->busy = 0;
+		if (s->stale) {
+			s->stale = 0;
+			continue;
+		}
+		if (res == -EINVAL && r->direct)
+			buffered(r);
+		else if (res != -EAGAIN && res != -EINTR) {
+			s->len = res;
+			s->done = 1;
+			continue;
+		}
+		queue_read(r, s, s->off);
+	}
+}
+
+static struct uring_slot *slot_at(struct uring *r, off_t off)
+{
+	unsigned i;
+
+	for (i = 0; i < URING_SLOTS; ++i) {
+		struct uring_slot *s = &r->slot[i];
+
+		if (((s->busy && !s->stale) || s->done) && s->off == off)
+			return s;
+	}
+	return NULL;
+}
+
+static int in_flight(const struct uring *r)
+{
+	unsigned i;
+
+	for (i = 0; i < URING_SLOTS; ++i)
+		if (r->slot[i].busy)
+			return 1;
+	return 0;
+}
+
+static struct uring_slot *find_slot(struct uring *r, off_t pos)
+{
+	unsigned i;
+
+	for (i = 0; i < URING_SLOTS; ++i) {
+		struct uring_slot *s = &r->slot[i];
+
+		if (((s->busy && !s->stale) || s->done) &&
+		    s->off <= pos && pos < s->off + URING_CHUNK)
+			return s;
+	}
+	return NULL;
+}
+
+static struct uring_slot *free_slot(struct uring *r)
+{
+	unsigned i;
+
+	for (i = 0; i < URING_SLOTS; ++i)
+		if (!r->slot[i].busy && !r->slot[i].done)
+			return &r->slot[i];
+	return NULL;
+}
+
+static void drop_slot(struct uring *r, struct uring_slot *s)
+{
+	if (s->busy)
+		s->stale = 1;
+	s->done = 0;
+	if (s == r->current)
+		r->current = NULL;
+}
+
+/* queue the chunks from *next up to end into the free slots */
+static void fill(struct uring *r, off_t *next, off_t end)
+{
+	for (; *next < end; *next += URING_CHUNK)
+		if (!slot_at(r, *next)) {
+			struct uring_slot *s = free_slot(r);
+
+			if (!s)
+				break;
+			queue_read(r, s, *next);
+		}
+}
+
+/*
+ * The range being read goes first, read-ahead takes what is left. If the
+ * ring refuses them, uring_next() submits them again and tells.
+ */
+static void refill(struct uring *r)
+{
+	fill(r, &r->queued, r->end);
+	fill(r, &r->ahead, r->ahead_end);
+	submit(r, 0);
+}
+
+static inline off_t align_down(off_t off)
+{
+	return off & ~(off_t)(URING_ALIGN - 1);
+}
+
+void uring_start(struct uring *r, off_t off, off_t end)
+{
+	off_t base = align_down(off);
+	unsigned i;
+
+	for (i = 0; i < URING_SLOTS; ++i) {
+		struct uring_slot *s = &r->slot[i];
+
+		/* a short read is the end of the file as it was then */
+		if (s->off < base || s->off >= end || (s->off - base) % URING_CHUNK ||
+		    (s->done && s->len < URING_CHUNK))
+			drop_slot(r, s);
+	}
+	r->current = NULL;
+	r->base = base;
+	r->end = end;
+	r->queued = base;
+	r->ahead = r->ahead_end = 0;
+	refill(r);
+}
+
+void uring_ahead(struct uring *r, off_t off, off_t end)
+{
+	r->ahead = align_down(off);
+	r->ahead_end = end;
+	refill(r);
+}
+
+ssize_t uring_next(struct uring *r, off_t pos, const uint8_t **data, size_t count)
+{
+	struct uring_slot *s = r->current;
+	size_t n;
+
+	/* the caller is done with the chunk it had */
+	if (s && (pos < s->off || pos >= s->off + URING_CHUNK)) {
+		s->done = 0;
+		r->current = NULL;
+	}
+	for (;;) {
+		reap(r);
+		s = find_slot(r, pos);
+		if (s && s->done)
+			break;
+		if (!s) {
+			unsigned i;
+
+			/* not queued yet, or read from somewhere else */
+			if (pos < r->base || pos >= r->end)
+				uring_start(r, pos, pos + count);
+			else if (pos < r->queued)
+				r->queued = r->base + (pos - r->base) / URING_CHUNK * URING_CHUNK;
+			/* all slots hold data nobody reads */
+			if (!free_slot(r) && !in_flight(r))
+				for (i = 0; i < URING_SLOTS; ++i)
+					drop_slot(r, &r->slot[i]);
+			refill(r);
+			s = find_slot(r, pos);
+			if (s && s->done)
+				break;
+		}
+		if (submit(r, 1) == -1)
+			return -1;
+	}
+	if (s->len < 0) {
+		errno = -s->len;
+		s->done = 0;
+		refill(r);
+		return -1;
+	}
+	n = pos - s->off;
+	if ((ssize_t)n >= s->len)
+		return 0;
+	*data = s->buf + n;
+	r->current = s;
+	refill(r);
+	return (size_t)s->len - n < count ? (size_t)s->len - n : count;
+}
@@ -0,0 +1,30 @@
+#ifndef _URING_H_
+#define _URING_H_ 1
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Reads of a regular file on io_uring. Up to URING_SLOTS reads of
+ * URING_CHUNK bytes are kept in flight ahead of the reader, into buffers
+ * aligned for O_DIRECT, so a huge file can be scanned past the page cache.
+ */
+#define URING_SLOTS (8)
+#define URING_CHUNK (1024 * 1024)
+#define URING_ALIGN (4096)
+
+struct uring;
+
+/* NULL if io_uring is not available */
+struct uring *uring_new(int fd, int direct);
+/* read [off, end) from now on, what was read of it already is kept unless short */
+void uring_start(struct uring *, off_t off, off_t end);
+/* queue reads of [off, end) into the slots the current range leaves free */
+void uring_ahead(struct uring *, off_t off, off_t end);
+/*
+ * The data at pos, at most count bytes, waits for its read if needed.
+ * Returns -1 with errno if the read or the ring failed.
+ */
+ssize_t uring_next(struct uring *, off_t pos, const uint8_t **data, size_t count);
+
+#endif /* _URING_H_ */